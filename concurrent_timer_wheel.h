@@ -0,0 +1,310 @@
+#ifndef _CONCURRENT_TIMER_WHEEL_H_
+#define _CONCURRENT_TIMER_WHEEL_H_
+
+//多线程可用的时间轮: 任何线程都可以schedule/cancel_timer, 只有一个线程(所有者)调用expire.
+//  1. schedule/cancel_timer不加锁: 节点从无锁栈(Treiber stack)中分配, 命令通过无锁的MPSC队列交给所有者线程
+//  2. expire时所有者线程一次取走队列中的全部命令, 批量加入/移除Timer_wheel, 然后触发到期的定时器
+//  3. 句柄是(节点下标, 代数), 节点回收时代数加1; 定时器触发或取消后句柄失效, 再cancel_timer只会返回失败,
+//     不会误取消重用了该节点的其它定时器
+//用法:
+//  Concurrent_Timer_wheel w;
+//  Concurrent_Timer_wheel::Timer_id id = w.schedule(&tv, 0, [] { ... });   //任意线程
+//  w.cancel_timer(id);                                                     //任意线程
+//  w.expire(&now);                                                         //所有者线程循环调用
+//注意:
+//  周期性定时器的取消与触发同时发生时, 回调可能还会再执行一次
+
+#include "timer_wheel.h"
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+
+#ifdef WIN32
+#   include <winsock2.h>
+#else
+#   include <sys/time.h>
+#endif
+
+class Concurrent_Timer_wheel
+{
+public:
+    //高32位为代数, 低32位为节点下标. 0为无效值
+    typedef uint64_t Timer_id;
+
+    enum {
+        INDEX_BITS = 22,                //节点下标的位数, 最多 4M 个同时存在的定时器. 句柄低32位中其余的位可由上层使用
+        CHUNK_BITS = 10,
+        CHUNK_SIZE = 1 << CHUNK_BITS,   //每次分配的节点数
+        MAX_CHUNKS = 1 << (INDEX_BITS - CHUNK_BITS),
+    };
+
+    Concurrent_Timer_wheel() : free_head_(0), chunk_count_(0), adds_(nullptr), cancels_(nullptr)
+    {
+        for (int i = 0; i < MAX_CHUNKS; ++i) {
+            chunks_[i] = nullptr;
+        }
+    }
+
+    ~Concurrent_Timer_wheel()
+    {
+        for (int i = 0; i < MAX_CHUNKS; ++i) {
+            delete[] chunks_[i].load();
+        }
+    }
+
+    //新增一个定时器, 任意线程可调用. 返回0为失败
+    template<typename F, typename ...Args>
+    Timer_id schedule(
+                     const timeval* expire_tv,     //超时时间
+                     unsigned long interval,       //0:一次性定时器; >0 :周期性定时器. 单位：毫秒
+                     F&& f,
+                     Args&& ...args
+                     )
+    {
+        Node* n = alloc_node();
+        if (!n) {
+            return 0;
+        }
+        n->fn       = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+        n->expires  = *expire_tv;
+        n->interval = interval;
+
+        uint64_t gen = n->tag.load(std::memory_order_relaxed) >> 32;
+        n->tag.store(make_tag(gen, SCHEDULED), std::memory_order_release);
+        push(adds_, n, &Node::add_next);
+        return (gen << 32) | n->index;
+    }
+
+    //取消一个定时器, 任意线程可调用. 0-成功, 其它值-失败(已触发、已取消或句柄无效)
+    int cancel_timer(Timer_id id)
+    {
+        Node* n = find_node(static_cast<uint32_t>(id));
+        if (!n) {
+            return -1;
+        }
+        uint64_t expect = make_tag(id >> 32, SCHEDULED);
+        if (!n->tag.compare_exchange_strong(expect, make_tag(id >> 32, CANCELLED))) {
+            return -1;
+        }
+        push(cancels_, n, &Node::cancel_next);
+        return 0;
+    }
+
+    //所有者线程循环调用: 处理其它线程提交的命令, 然后触发所有过期的定时器
+    int expire(const timeval* tv)
+    {
+        drain();
+        return wheel_.expire(tv);
+    }
+
+    //所有者线程调用. 还有未处理的命令时返回0
+    long next_timeout(const timeval* tv)
+    {
+        if (adds_.load(std::memory_order_relaxed) || cancels_.load(std::memory_order_relaxed)) {
+            return 0;
+        }
+        return wheel_.next_timeout(tv);
+    }
+
+private:
+    enum State {
+        FREE = 0,
+        SCHEDULED,
+        CANCELLED,
+        FIRED,
+    };
+
+    struct Node {
+        std::atomic<uint64_t> tag;          //代数 << 32 | State
+        std::atomic<uint32_t> free_next;    //空闲栈中下一个节点的下标+1
+        uint32_t              index;
+        Node*                 add_next;     //MPSC队列的链接
+        Node*                 cancel_next;
+        Callback_Function     fn;
+        timeval               expires;
+        unsigned long         interval;
+
+        //以下只有所有者线程访问
+        Timer_handle          handle;
+        bool                  added;        //ADD命令已处理
+        bool                  cancel_seen;  //CANCEL命令已处理
+
+        Node() : tag(make_tag(1, FREE)), free_next(0), index(0), add_next(nullptr), cancel_next(nullptr),
+                 interval(0), handle(nullptr), added(false), cancel_seen(false)
+        {}
+    };
+
+    static uint64_t make_tag(uint64_t gen, State s) {
+        return (gen << 32) | s;
+    }
+
+    static State state_of(uint64_t tag) {
+        return static_cast<State>(tag & 0xffffffff);
+    }
+
+    Node* find_node(uint32_t index)
+    {
+        uint32_t c = index >> CHUNK_BITS;
+        if (c >= MAX_CHUNKS) {
+            return nullptr;
+        }
+        Node* chunk = chunks_[c].load(std::memory_order_acquire);
+        return chunk ? chunk + (index & (CHUNK_SIZE - 1)) : nullptr;
+    }
+
+    //无锁栈, free_head_为 (版本号 << 32 | 下标+1), 版本号避免ABA
+    Node* alloc_node()
+    {
+        for (;;) {
+            uint64_t head = free_head_.load(std::memory_order_acquire);
+            uint32_t top  = static_cast<uint32_t>(head);
+            if (top == 0) {
+                if (!grow()) {
+                    return nullptr;
+                }
+                continue;
+            }
+            Node* n = find_node(top - 1);
+            uint64_t next = ((head >> 32) + 1) << 32 | n->free_next.load(std::memory_order_relaxed);
+            if (free_head_.compare_exchange_weak(head, next, std::memory_order_acquire)) {
+                return n;
+            }
+        }
+    }
+
+    void free_node(Node* n)
+    {
+        n->fn          = nullptr;
+        n->handle      = nullptr;
+        n->added       = false;
+        n->cancel_seen = false;
+
+        uint64_t gen = (n->tag.load(std::memory_order_relaxed) >> 32) + 1;
+        n->tag.store(make_tag(gen & 0xffffffff ? gen : 1, FREE), std::memory_order_relaxed);
+
+        uint64_t head = free_head_.load(std::memory_order_relaxed);
+        do {
+            n->free_next.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+        } while (!free_head_.compare_exchange_weak(head, ((head >> 32) + 1) << 32 | (n->index + 1),
+                                                   std::memory_order_release));
+    }
+
+    //空闲栈为空时再分配一批节点, 只在定时器总数增长时发生
+    bool grow()
+    {
+        std::lock_guard<std::mutex> lock(grow_mutex_);
+        if (static_cast<uint32_t>(free_head_.load())) {
+            return true;    //其它线程刚分配过
+        }
+        uint32_t c = chunk_count_;
+        if (c >= MAX_CHUNKS) {
+            return false;
+        }
+
+        Node* chunk = new Node[CHUNK_SIZE];
+        for (uint32_t i = 0; i < CHUNK_SIZE; ++i) {
+            chunk[i].index = (c << CHUNK_BITS) | i;
+            chunk[i].free_next.store(i + 1 < CHUNK_SIZE ? chunk[i].index + 2 : 0, std::memory_order_relaxed);
+        }
+        chunks_[c].store(chunk, std::memory_order_release);
+        chunk_count_ = c + 1;
+
+        //整批挂到空闲栈上
+        Node& last = chunk[CHUNK_SIZE - 1];
+        uint64_t head = free_head_.load(std::memory_order_relaxed);
+        do {
+            last.free_next.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+        } while (!free_head_.compare_exchange_weak(head, ((head >> 32) + 1) << 32 | (chunk[0].index + 1),
+                                                   std::memory_order_release));
+        return true;
+    }
+
+    //MPSC队列: 生产者压栈, 所有者一次取走全部再反转成提交顺序
+    static void push(std::atomic<Node*>& head, Node* n, Node* Node::*link)
+    {
+        Node* old = head.load(std::memory_order_relaxed);
+        do {
+            n->*link = old;
+        } while (!head.compare_exchange_weak(old, n, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    static Node* take_all(std::atomic<Node*>& head, Node* Node::*link)
+    {
+        Node* n = head.exchange(nullptr, std::memory_order_acquire);
+        Node* fifo = nullptr;
+        while (n) {
+            Node* next = n->*link;
+            n->*link = fifo;
+            fifo = n;
+            n = next;
+        }
+        return fifo;
+    }
+
+    void drain()
+    {
+        //先处理ADD再处理CANCEL. 某个CANCEL的ADD还没取到时, 由之后处理ADD时回收节点
+        Node* n = take_all(adds_, &Node::add_next);
+        while (n) {
+            Node* next = n->add_next;
+            n->added = true;
+            if (state_of(n->tag.load(std::memory_order_acquire)) == CANCELLED) {
+                if (n->cancel_seen) {
+                    free_node(n);
+                }
+            } else {
+                n->handle = wheel_.schedule(&n->expires, n->interval, &Concurrent_Timer_wheel::fire, this, n);
+            }
+            n = next;
+        }
+
+        n = take_all(cancels_, &Node::cancel_next);
+        while (n) {
+            Node* next = n->cancel_next;
+            n->cancel_seen = true;
+            if (n->added) {
+                if (n->handle) {
+                    wheel_.cancel_timer(n->handle);
+                }
+                free_node(n);
+            }
+            n = next;
+        }
+    }
+
+    //在所有者线程中由Timer_wheel回调
+    void fire(Node* n)
+    {
+        uint64_t tag = n->tag.load(std::memory_order_acquire);
+        if (n->interval > 0) {
+            if (state_of(tag) == SCHEDULED) {
+                n->fn();
+            }
+            return;
+        }
+
+        //一次性定时器触发后Timer_wheel已回收它的节点
+        n->handle = nullptr;
+        uint64_t expect = make_tag(tag >> 32, SCHEDULED);
+        if (n->tag.compare_exchange_strong(expect, make_tag(tag >> 32, FIRED), std::memory_order_acquire)) {
+            n->fn();
+            free_node(n);
+        }
+        //否则已被取消, 由CANCEL命令回收
+    }
+
+private:
+    Concurrent_Timer_wheel(const Concurrent_Timer_wheel&);
+    Concurrent_Timer_wheel& operator=(const Concurrent_Timer_wheel&);
+
+private:
+    Timer_wheel           wheel_;
+    std::atomic<uint64_t> free_head_;
+    std::atomic<Node*>    chunks_[MAX_CHUNKS];
+    uint32_t              chunk_count_;     //由grow_mutex_保护
+    std::mutex            grow_mutex_;
+    std::atomic<Node*>    adds_;
+    std::atomic<Node*>    cancels_;
+};
+
+#endif
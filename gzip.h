@@ -1,4 +1,9 @@
-﻿#include <string>
+﻿#ifndef _GZIP_H_
+#define _GZIP_H_
+
+#include <string>
+#include <stdio.h>
+#include <string.h>
 
 /*
 * this file is from: https://github.com/chafey/GZipCodec
@@ -24,35 +29,109 @@ GZIP_NAMESPACE_BEGIN
 #define windowBits 15
 #define GZIP_ENCODING 16
 
-bool compress(const char *data, int len, std::string& compressedData, int level = -1)
+//流式压缩: 数据可以分多次给, 不用一次全部放在内存里
+//  Compressor c;
+//  c.compress(part1, len1, out);
+//  c.compress(part2, len2, out, true);     //最后一次finish为true
+class Compressor
 {
-    z_stream strm;
-    strm.zalloc = Z_NULL;
-    strm.zfree  = Z_NULL;
-    strm.opaque = Z_NULL;
-    if (deflateInit2(&strm, level, Z_DEFLATED, windowBits | GZIP_ENCODING, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+public:
+    explicit Compressor(int level = -1)
     {
-        return false;
+        memset(&strm_, 0, sizeof(strm_));
+        strm_.zalloc = Z_NULL;
+        strm_.zfree  = Z_NULL;
+        strm_.opaque = Z_NULL;
+        ok_ = deflateInit2(&strm_, level, Z_DEFLATED, windowBits | GZIP_ENCODING, 8, Z_DEFAULT_STRATEGY) == Z_OK;
     }
 
-    unsigned char out[CHUNK];
-    strm.next_in = (unsigned char*)data;
-    strm.avail_in = len;
-    do {
-        int have;
-        strm.avail_out = CHUNK;
-        strm.next_out = out;
-        if (deflate(&strm, Z_FINISH) == Z_STREAM_ERROR) {
+    ~Compressor()
+    {
+        if (ok_) {
+            deflateEnd(&strm_);
+        }
+    }
+
+    bool ok() const {
+        return ok_;
+    }
+
+    //压缩len字节, 输出追加到compressedData
+    bool compress(const char* data, size_t len, std::string& compressedData, bool finish = false)
+    {
+        if (!ok_) {
             return false;
         }
-        have = CHUNK - strm.avail_out;
-        compressedData.append((char*)out, have);
-    } while (strm.avail_out == 0);
 
-    return deflateEnd(&strm) == Z_OK;
+        unsigned char out[CHUNK];
+        strm_.next_in  = (unsigned char*)data;
+        strm_.avail_in = (uInt)len;
+        do {
+            int have;
+            strm_.avail_out = CHUNK;
+            strm_.next_out  = out;
+            if (deflate(&strm_, finish ? Z_FINISH : Z_NO_FLUSH) == Z_STREAM_ERROR) {
+                return false;
+            }
+            have = CHUNK - strm_.avail_out;
+            compressedData.append((char*)out, have);
+        } while (strm_.avail_out == 0);
+
+        return true;
+    }
+
+private:
+    Compressor(const Compressor&);
+    Compressor& operator=(const Compressor&);
+
+private:
+    z_stream strm_;
+    bool     ok_;
+};
+
+inline bool compress(const char *data, int len, std::string& compressedData, int level = -1)
+{
+    Compressor c(level);
+    return c.compress(data, len, compressedData, true);
 }
 
-bool uncompress(const char* compressedData, int len, std::string& data)
+//把文件src压缩成gzip文件dst, 每次只读CHUNK * 4字节
+inline bool compress_file(const char* src, const char* dst, int level = -1)
+{
+    FILE* in = fopen(src, "rb");
+    if (!in) {
+        return false;
+    }
+    FILE* out = fopen(dst, "wb");
+    if (!out) {
+        fclose(in);
+        return false;
+    }
+
+    Compressor c(level);
+    bool ok = c.ok();
+    std::string buf;
+    char chunk[CHUNK * 4];
+    while (ok) {
+        size_t n = fread(chunk, 1, sizeof(chunk), in);
+        bool finish = n < sizeof(chunk);
+        if (finish && ferror(in)) {
+            ok = false;
+            break;
+        }
+        buf.clear();
+        ok = c.compress(chunk, n, buf, finish) && fwrite(buf.data(), 1, buf.size(), out) == buf.size();
+        if (finish) {
+            break;
+        }
+    }
+
+    fclose(in);
+    ok = fclose(out) == 0 && ok;
+    return ok;
+}
+
+inline bool uncompress(const char* compressedData, int len, std::string& data)
 {
     z_stream strm;
     strm.zalloc = Z_NULL;
@@ -113,3 +192,5 @@ inline std::string uncompress(const std::string& compressedData) {
 }
 
 GZIP_NAMESPACE_END
+
+#endif
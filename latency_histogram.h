@@ -0,0 +1,195 @@
+#ifndef _LATENCY_HISTOGRAM_H_
+#define _LATENCY_HISTOGRAM_H_
+
+//HDR风格的延迟直方图(对数-线性分桶):
+//  每个2的幂区间再均分成16个子桶, 相对误差不超过1/16(6.25%), 可记录 0 ~ 2^40 (纳秒约18分钟), 更大的值计入最后一个桶.
+//  record()只允许一个线程写(例如每个worker一个直方图), 不加锁, 也没有原子的读-改-写指令;
+//  其它线程可以随时调用snapshot()读取, 读到的是近似一致的快照.
+//用法:
+//  Latency_Histogram h;
+//  h.record(ns);
+//  Latency_Histogram::Snapshot s;
+//  h.snapshot(s);
+//  s.percentile(99.9);
+
+#include <atomic>
+#include <cstring>
+#include <stdint.h>
+#ifdef _MSC_VER
+#   include <intrin.h>
+#endif
+
+class Latency_Histogram
+{
+public:
+    enum {
+        SUB_BITS     = 4,
+        SUB_COUNT    = 1 << SUB_BITS,
+        MAX_BITS     = 40,
+        BUCKET_COUNT = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT,
+    };
+
+    //v的最高置位的位置, v不能为0
+    static int msb64(uint64_t v)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, v);
+        return static_cast<int>(index);
+#else
+        return 63 - __builtin_clzll(v);
+#endif
+    }
+
+    //值v落在哪个桶
+    static int bucket_index(uint64_t v)
+    {
+        if (v < SUB_COUNT) {
+            return static_cast<int>(v);
+        }
+        int msb = msb64(v);
+        if (msb >= MAX_BITS) {
+            return BUCKET_COUNT - 1;
+        }
+        int shift = msb - SUB_BITS;
+        return (shift + 1) * SUB_COUNT + static_cast<int>((v >> shift) & (SUB_COUNT - 1));
+    }
+
+    //桶的下界
+    static uint64_t bucket_lower(int index)
+    {
+        if (index < SUB_COUNT) {
+            return static_cast<uint64_t>(index);
+        }
+        int shift = index / SUB_COUNT - 1;
+        return static_cast<uint64_t>(SUB_COUNT + index % SUB_COUNT) << shift;
+    }
+
+    //桶的上界(不含)
+    static uint64_t bucket_upper(int index)
+    {
+        if (index < SUB_COUNT) {
+            return static_cast<uint64_t>(index) + 1;
+        }
+        return bucket_lower(index) + (static_cast<uint64_t>(1) << (index / SUB_COUNT - 1));
+    }
+
+    //读取出来的直方图, 可以合并多个
+    struct Snapshot {
+        uint64_t counts[BUCKET_COUNT];
+        uint64_t total;
+        uint64_t sum;
+        uint64_t max;
+
+        Snapshot() {
+            clear();
+        }
+
+        void clear() {
+            memset(counts, 0, sizeof(counts));
+            total = sum = max = 0;
+        }
+
+        void merge(const Snapshot& o)
+        {
+            for (int i = 0; i < BUCKET_COUNT; ++i) {
+                counts[i] += o.counts[i];
+            }
+            total += o.total;
+            sum   += o.sum;
+            if (o.max > max) {
+                max = o.max;
+            }
+        }
+
+        double mean() const {
+            return total ? static_cast<double>(sum) / total : 0.0;
+        }
+
+        //百分位数, p取值0~100. 返回所在桶的上界(不超过max)
+        uint64_t percentile(double p) const
+        {
+            if (total == 0) {
+                return 0;
+            }
+            uint64_t rank = static_cast<uint64_t>(p / 100.0 * total + 0.5);
+            if (rank < 1) {
+                rank = 1;
+            }
+            uint64_t seen = 0;
+            for (int i = 0; i < BUCKET_COUNT; ++i) {
+                seen += counts[i];
+                if (seen >= rank) {
+                    uint64_t v = bucket_upper(i) - 1;
+                    return v < max ? v : max;
+                }
+            }
+            return max;
+        }
+    };
+
+public:
+    Latency_Histogram()
+    {
+        for (int i = 0; i < BUCKET_COUNT; ++i) {
+            counts_[i].store(0, std::memory_order_relaxed);
+        }
+        total_.store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+    //只能由一个线程调用
+    void record(uint64_t v)
+    {
+        bump(counts_[bucket_index(v)], 1);
+        bump(total_, 1);
+        bump(sum_, v);
+        if (v > max_.load(std::memory_order_relaxed)) {
+            max_.store(v, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t count() const {
+        return total_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t sum() const {
+        return sum_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t max() const {
+        return max_.load(std::memory_order_relaxed);
+    }
+
+    //把当前数据累加到s中
+    void snapshot(Snapshot& s) const
+    {
+        for (int i = 0; i < BUCKET_COUNT; ++i) {
+            s.counts[i] += counts_[i].load(std::memory_order_relaxed);
+        }
+        s.total += total_.load(std::memory_order_relaxed);
+        s.sum   += sum_.load(std::memory_order_relaxed);
+        uint64_t m = max_.load(std::memory_order_relaxed);
+        if (m > s.max) {
+            s.max = m;
+        }
+    }
+
+private:
+    //单写者, 用load+store代替fetch_add, 避免带lock前缀的指令
+    static void bump(std::atomic<uint64_t>& a, uint64_t n) {
+        a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    Latency_Histogram(const Latency_Histogram&);
+    Latency_Histogram& operator=(const Latency_Histogram&);
+
+private:
+    std::atomic<uint64_t> counts_[BUCKET_COUNT];
+    std::atomic<uint64_t> total_;
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> max_;
+};
+
+#endif
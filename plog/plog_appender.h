@@ -9,10 +9,39 @@
 #include <mutex>
 #include <fstream>
 #include <cstring>
+#include <chrono>
+#include <unordered_map>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <atomic>
+#include <vector>
+
+#if !defined(WIN32) && !defined(__MINGW32__)
+#   define DLOG_HAS_MMAP 1
+#   include <sys/mman.h>
+#endif
+
+#ifdef DLOG_GZIP
+#   include <deque>
+#   include <thread>
+#   include <functional>
+#   include <condition_variable>
+#   include <algorithm>
+#   include "../gzip.h"
+#   if !defined(WIN32) && !defined(__MINGW32__)
+#       include <sys/resource.h>
+#       include <dirent.h>
+#   else
+#       include <io.h>
+#   endif
+#endif
 
 
 DLOG_NAMESPACE_BEGIN
 
+using std::string;
+
 
 template<class Formatter>
 class Console_Appender : public IAppender
@@ -26,16 +55,293 @@ public:
     }
 };
 
+//文件appender什么时候把缓存的日志写到文件, 满足任一条件就写.
+//默认值不同: Date_Size_File_Appender以前每条日志都flush, 默认every_batch(), 写线程取到的每一批都立即写出(仍是一批一次write),
+//进程崩溃不会丢已经交给写线程的日志; Rolling_File_Appender以前就用带缓存的ofstream, 默认按64K/200ms写.
+//需要更高吞吐时用set_flush_policy(Flush_Policy())打开缓存, 代价是崩溃时可能丢掉还在缓存中的日志
+struct Flush_Policy
+{
+    size_t   bytes;     //缓存达到这么多字节. 0为每批都写
+    unsigned ms;        //最早的一条缓存了这么多毫秒. 0为不按时间
+    Severity severity;  //这一批有这个级别及以上的日志. none为不按级别
+
+    Flush_Policy(size_t b = 64 * 1024, unsigned m = 200, Severity s = error)
+        : bytes(b), ms(m), severity(s)
+    {}
+
+    //不缓存, 每一批都写出
+    static Flush_Policy every_batch() {
+        return Flush_Policy(0, 0, none);
+    }
+};
+
+//追加写的日志文件: 一批日志格式化到buffer()后调用commit, 按Flush_Policy一次write写出, 而不是每条一次系统调用.
+//另外独立线程模式下写线程空闲时会调用appender的flush, 缓存不会一直留着
+class Log_File
+{
+public:
+    enum {
+        MAX_PENDING = 4 * 1024 * 1024,  //写失败时最多保留这么多字节等下次重试, 超过的丢弃并计入lost_bytes()
+    };
+
+    Log_File() : fd_(-1), size_(0), lost_(0) {}
+
+    ~Log_File() {
+        close();
+    }
+
+    //追加方式打开, 返回0为成功
+    int open(const std::string& name)
+    {
+        close();
+#ifdef WIN32
+        fd_ = ::_open(name.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+        fd_ = ::open(name.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+#endif
+        if (fd_ < 0) {
+            return -1;
+        }
+#ifdef WIN32
+        long n = ::_lseek(fd_, 0, SEEK_END);
+#else
+        off_t n = ::lseek(fd_, 0, SEEK_END);
+#endif
+        size_ = n > 0 ? static_cast<size_t>(n) : 0;
+        return 0;
+    }
+
+    bool is_open() const {
+        return fd_ >= 0;
+    }
+
+    //写出缓存后关闭, 写不出去的计入lost_bytes()
+    void close()
+    {
+        if (fd_ >= 0) {
+            flush();
+#ifdef WIN32
+            ::_close(fd_);
+#else
+            ::close(fd_);
+#endif
+            fd_ = -1;
+        }
+        lost_ += buf_.size();
+        buf_.clear();
+        pending_since_ = std::chrono::steady_clock::time_point();
+        size_ = 0;
+    }
+
+    //写失败而丢弃的字节数
+    uint64_t lost_bytes() const {
+        return lost_;
+    }
+
+    //文件大小, 包括还没写出的部分
+    size_t size() const {
+        return size_ + buf_.size();
+    }
+
+    std::string& buffer() {
+        return buf_;
+    }
+
+    //把这一批追加到buffer()之后调用. urgent: 这一批有需要立即写的日志
+    void commit(const Flush_Policy& policy, bool urgent)
+    {
+        if (buf_.empty()) {
+            return;
+        }
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (pending_since_ == std::chrono::steady_clock::time_point()) {
+            pending_since_ = now;
+        }
+
+        if (urgent || buf_.size() >= policy.bytes ||
+            (policy.ms > 0 && now - pending_since_ >= std::chrono::milliseconds(policy.ms))) {
+            flush();
+        }
+    }
+
+    //把缓存写到文件, 返回0为成功. 失败时没写出的部分留在缓存中, 下次再写;
+    //超过MAX_PENDING时丢弃并计入lost_bytes(), 磁盘满等持续失败时缓存不会无限增长
+    int flush()
+    {
+        int ret = 0;
+        const char* p = buf_.data();
+        size_t left   = buf_.size();
+        while (left > 0 && fd_ >= 0) {
+#ifdef WIN32
+            long n = ::_write(fd_, p, static_cast<unsigned int>(left));
+#else
+            ssize_t n = ::write(fd_, p, left);
+#endif
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                ret = -1;
+                break;
+            }
+            p    += n;
+            left -= n;
+        }
+
+        size_ += buf_.size() - left;
+        if (fd_ < 0) {
+            ret = -1;
+        }
+        if (ret == 0) {
+            buf_.clear();
+            pending_since_ = std::chrono::steady_clock::time_point();
+        } else if (left > MAX_PENDING) {
+            lost_ += left;
+            buf_.clear();
+            pending_since_ = std::chrono::steady_clock::time_point();
+        } else {
+            buf_.erase(0, buf_.size() - left);
+        }
+        return ret;
+    }
+
+private:
+    Log_File(const Log_File&);
+    Log_File& operator=(const Log_File&);
+
+private:
+    int         fd_;
+    size_t      size_;      //已写到文件的大小
+    uint64_t    lost_;      //写失败而丢弃的字节数
+    std::string buf_;
+    std::chrono::steady_clock::time_point pending_since_;  //缓存中最早一批的时间
+};
+
+#ifdef DLOG_GZIP
+//后台压缩轮转出来的日志文件. 一个低优先级的线程按提交的顺序执行任务, 第一次post时才创建.
+//post只是放进队列, 写日志的线程不会等待压缩; 析构时做完剩下的任务
+class Log_Compressor
+{
+public:
+    typedef std::function<void()> Task;
+
+    Log_Compressor() : stopping_(false) {}
+
+    ~Log_Compressor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_one();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    void post(const Task& task)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(task);
+        if (!thread_.joinable()) {
+            thread_ = std::thread(&Log_Compressor::run, this);
+        }
+        cv_.notify_one();
+    }
+
+    //把src压缩成dst后删除src, 返回0为成功. 先写到dst.tmp, 完成后才改名, 中途退出不会留下不完整的dst
+    static int gzip_file(const std::string& src, const std::string& dst)
+    {
+        std::string tmp = dst + ".tmp";
+        if (!gzip::compress_file(src.c_str(), tmp.c_str())) {
+            ::unlink(tmp.c_str());
+            return -1;
+        }
+        if (::rename(tmp.c_str(), dst.c_str()) != 0) {
+            ::unlink(tmp.c_str());
+            return -1;
+        }
+        ::unlink(src.c_str());
+        return 0;
+    }
+
+    //目录dir下的文件名(不含路径)
+    static void list_dir(const std::string& dir, std::vector<std::string>& names)
+    {
+#if defined(WIN32) || defined(__MINGW32__)
+        _finddata_t data;
+        intptr_t h = ::_findfirst((dir + "/*").c_str(), &data);
+        if (h == -1) {
+            return;
+        }
+        do {
+            names.push_back(data.name);
+        } while (::_findnext(h, &data) == 0);
+        ::_findclose(h);
+#else
+        DIR* d = ::opendir(dir.c_str());
+        if (!d) {
+            return;
+        }
+        while (struct dirent* e = ::readdir(d)) {
+            names.push_back(e->d_name);
+        }
+        ::closedir(d);
+#endif
+    }
+
+private:
+    void run()
+    {
+#if defined(WIN32) || defined(__MINGW32__)
+        ::SetThreadPriority(::GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#elif defined(__linux__)
+        ::setpriority(PRIO_PROCESS, log_util::get_thread_id(), 19);   //linux下nice值是按线程的
+#endif
+        for (;;) {
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+                if (tasks_.empty()) {
+                    return;
+                }
+                task = tasks_.front();
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+private:
+    Log_Compressor(const Log_Compressor&);
+    Log_Compressor& operator=(const Log_Compressor&);
+
+private:
+    std::mutex              mutex_;
+    std::condition_variable cv_;
+    std::deque<Task>        tasks_;
+    bool                    stopping_;
+    std::thread             thread_;
+};
+#endif
+
 //plog自带的日志函数，未经测试
 template<class Formatter>
 class Rolling_File_Appender : public IAppender
 {
 public:
-    Rolling_File_Appender(const char* fileName, size_t maxFileSize = 0, int maxFiles = 0)
-        : m_fileSize()
-        , m_maxFileSize((std::max)(maxFileSize, static_cast<size_t>(1000))) // set a lower limit for the maxFileSize
+    Rolling_File_Appender(const char* fileName, size_t maxFileSize = 0, int maxFiles = 0,
+                          const Flush_Policy& policy = Flush_Policy())
+        : m_maxFileSize((std::max)(maxFileSize, static_cast<size_t>(1000))) // set a lower limit for the maxFileSize
         , m_lastFileNumber((std::max)(maxFiles - 1, 0))
         , m_firstWrite(true)
+        , m_policy(policy)
+#ifdef DLOG_GZIP
+        , m_compress(false)
+        , m_rollSeq(0)
+#endif
     {
         const char* dot = std::strrchr(fileName, '.');
         if (dot) {
@@ -48,30 +354,77 @@ public:
     }
 
     virtual void write(const Record& record)
+    {
+        const Record* p = &record;
+        write_batch(&p, 1);
+    }
+
+    virtual void write_batch(const Record* const* records, size_t count)
     {
         std::unique_lock<std::mutex> lock(m_mutex);
 
-        if (m_firstWrite) {
-            openLogFile();
-            m_firstWrite = false;
-        }
-        else if (m_lastFileNumber > 0 && 
-                 m_fileSize > m_maxFileSize && 
-                 static_cast<size_t>(-1) != m_fileSize
-                ) {
-            rollLogFiles();
+        bool urgent = false;
+        for (size_t i = 0; i < count; ++i) {
+            if (m_firstWrite) {
+#ifdef DLOG_GZIP
+                if (m_compress) {
+                    recoverStaged();
+                }
+#endif
+                openLogFile();
+                m_firstWrite = false;
+            }
+            else if (m_lastFileNumber > 0 && m_file.size() > m_maxFileSize) {
+                rollLogFiles();
+            }
+
+            Formatter::format_to(*records[i], m_file.buffer());
+            urgent = urgent || records[i]->getSeverity() >= m_policy.severity;
         }
+        m_file.commit(m_policy, urgent);
+    }
+
+    virtual void flush()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_file.flush();
+    }
 
-        const std::string& log = Formatter::format(record);
-        m_file.write(log.c_str(), log.size());
-        m_fileSize += log.size();
+    void set_flush_policy(const Flush_Policy& policy)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_policy = policy;
     }
 
+    //写文件失败而丢弃的字节数
+    uint64_t lost_bytes()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        return m_file.lost_bytes();
+    }
+
+#ifdef DLOG_GZIP
+    //轮转出来的文件压缩成name.1.txt.gz, name.2.txt.gz...
+    void set_compress(bool compress)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_compress = compress;
+    }
+#endif
+
 private:
     void rollLogFiles()
     {
         m_file.close();
 
+#ifdef DLOG_GZIP
+        if (m_compress) {
+            rollCompressed();
+            openLogFile();
+            return;
+        }
+#endif
+
         string lastFileName = buildFileName(m_lastFileNumber);
         ::unlink(lastFileName.c_str());
 
@@ -87,19 +440,97 @@ private:
     void openLogFile()
     {
         string fileName = buildFileName();
-        m_file.open(fileName.c_str(), std::ios::app|std::ios::binary);
-        if (!m_file) {
+        if (m_file.open(fileName) != 0) {
             std::cerr << "open file failed: " << fileName;
         }
-        m_fileSize = m_file.tellp();
 
-        if (0 == m_fileSize) {
-            const std::string& log = Formatter::header();
-            m_file.write(log.c_str(), log.size());
-            m_fileSize += log.size();
+        if (0 == m_file.size()) {
+            m_file.buffer() += Formatter::header();
+        }
+    }
+
+#ifdef DLOG_GZIP
+    //这里只把当前文件改成一个临时的名字; 删除最旧的、编号后移、压缩都在Log_Compressor的线程中按顺序做,
+    //不会和还没做完的压缩冲突, 也不阻塞写日志
+    void rollCompressed()
+    {
+        string current = buildFileName();
+        std::stringstream ss;
+        ss << current << '.' << time(NULL) << '.' << ++m_rollSeq << ".roll";
+        string staged = ss.str();
+        if (::rename(current.c_str(), staged.c_str()) != 0) {
+            return;
         }
+
+        postRoll(staged);
     }
 
+    //删除最旧的、编号后移、把staged压缩成name.1.txt.gz. 压缩失败时staged改回name.1.txt,
+    //不会留下没人处理的.roll文件; 没压缩的name.N.txt也跟着编号后移, 到最后一个时删除
+    void postRoll(const string& staged)
+    {
+        std::vector<string> names;
+        for (int fileNumber = 1; fileNumber <= m_lastFileNumber; ++fileNumber) {
+            names.push_back(buildFileName(fileNumber));
+        }
+
+        m_compressor.post([names, staged]() {
+            ::unlink(names.back().c_str());
+            ::unlink((names.back() + ".gz").c_str());
+            for (size_t i = names.size() - 1; i > 0; --i) {
+                ::rename(names[i - 1].c_str(), names[i].c_str());
+                ::rename((names[i - 1] + ".gz").c_str(), (names[i] + ".gz").c_str());
+            }
+            if (Log_Compressor::gzip_file(staged, names[0] + ".gz") != 0) {
+                ::rename(staged.c_str(), names[0].c_str());
+            }
+        });
+    }
+
+    //上次运行时改了名还没来得及压缩的name.txt.<time>.<seq>.roll, 按轮转的顺序重新交给压缩线程. 第一次写日志时调用
+    void recoverStaged()
+    {
+        if (m_lastFileNumber <= 0) {
+            return;
+        }
+
+        string current = buildFileName();
+        string dir     = ".";
+        string base    = current;
+        size_t slash   = current.find_last_of("/\\");
+        if (slash != string::npos) {
+            dir  = current.substr(0, slash);
+            base = current.substr(slash + 1);
+        }
+        string prefix = base + ".";
+        string suffix = ".roll";
+
+        std::vector<string> names;
+        Log_Compressor::list_dir(dir, names);
+
+        //(time, seq, 文件名)
+        std::vector<std::pair<std::pair<unsigned long, unsigned long>, string> > staged;
+        for (size_t i = 0; i < names.size(); ++i) {
+            const string& name = names[i];
+            if (name.size() <= prefix.size() + suffix.size() || name.compare(0, prefix.size(), prefix) != 0 ||
+                name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+                continue;
+            }
+            unsigned long t = 0, seq = 0;
+            if (sscanf(name.c_str() + prefix.size(), "%lu.%lu", &t, &seq) != 2) {
+                continue;
+            }
+            string path = slash != string::npos ? dir + "/" + name : name;
+            staged.push_back(std::make_pair(std::make_pair(t, seq), path));
+        }
+
+        std::sort(staged.begin(), staged.end());
+        for (size_t i = 0; i < staged.size(); ++i) {
+            postRoll(staged[i].second);
+        }
+    }
+#endif
+
     string buildFileName(int fileNumber = 0)
     {
         std::stringstream ss;
@@ -117,13 +548,18 @@ private:
 
 private:
     std::mutex      m_mutex;
-    std::ofstream   m_file;
-    size_t          m_fileSize;
+    Log_File        m_file;
     const size_t    m_maxFileSize;
     const int       m_lastFileNumber;
     string          m_fileExt;
     string          m_fileNameNoExt;
     bool            m_firstWrite;
+    Flush_Policy    m_policy;
+#ifdef DLOG_GZIP
+    bool            m_compress;
+    unsigned        m_rollSeq;
+    Log_Compressor  m_compressor;       //最后一个成员, 最先析构: 等压缩做完
+#endif
 };
 
 //按天按大小输出日志文件
@@ -136,43 +572,87 @@ public:
     {
     }
 
-    Date_Size_File_Appender(const std::string& log_path, const std::string& module, int max_size)
+    Date_Size_File_Appender(const std::string& log_path, const std::string& module, int max_size,
+                            const Flush_Policy& policy = Flush_Policy::every_batch())
         :log_path_(log_path)
         ,module_(module)
         ,max_size_(max_size)
+        ,policy_(policy)
+#ifdef DLOG_GZIP
+        ,compress_(false)
+#endif
     {
         current_size_ = 0;
         backup_count_ = 0;
         today_        = time(NULL);
+        day_end_      = log_util::next_day(today_);
     }
 
 public:
 
     virtual void write(const Record& record)
     {
-        time_t now = time(NULL);
-        int d1 = now / 86400;
-        int d2 = today_ / 86400;
-        if (d1 != d2 || current_size_ >= max_size_) {
-            file_.close();
-            if (d1 != d2) {
-                backup_count_ = 0;
-            } else {
-                backup_count_ += 1;
+        const Record* p = &record;
+        write_batch(&p, 1);
+    }
+
+    //一批日志格式化到缓存后按flush policy写出, 换文件时先写出旧文件的缓存
+    virtual void write_batch(const Record* const* records, size_t count)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        bool urgent = false;
+        for (size_t i = 0; i < count; ++i) {
+            const Record& record = *records[i];
+
+            //用日志自己的时间, 不再取一次时钟
+            time_t now = record.getTime().time;
+            bool new_day = now >= day_end_;
+            if (new_day || current_size_ >= max_size_) {
+                file_.close();
+#ifdef DLOG_GZIP
+                if (compress_ && !file_name_.empty()) {
+                    std::string closed = file_name_;
+                    compressor_.post([closed]() {
+                        Log_Compressor::gzip_file(closed, closed + ".gz");
+                    });
+                }
+                file_name_.clear();
+#endif
+                if (new_day) {
+                    backup_count_ = 0;
+                } else {
+                    backup_count_ += 1;
+                }
+
+                current_size_  = 0;
+                today_         = now;
+                day_end_       = log_util::next_day(now);
             }
-            
-            current_size_  = 0;
-            today_         = now;
-        }
 
-        if (!file_.is_open()) {
-            std::string filename = calc_file_name();
-            file_.open(filename, std::ios::app|std::ios::binary);
+            if (!file_.is_open()) {
+                std::string filename = calc_file_name();
+                if (file_.open(filename) != 0) {
+                    std::cerr << "open file failed: " << filename;
+                }
+#ifdef DLOG_GZIP
+                file_name_ = filename;
+#endif
+            }
+
+            std::string& buf = file_.buffer();
+            size_t n = buf.size();
+            Formatter::format_to(record, buf);
+            current_size_ += static_cast<int>(buf.size() - n);
+            urgent = urgent || record.getSeverity() >= policy_.severity;
         }
+        file_.commit(policy_, urgent);
+    }
 
-        const std::string& data = Formatter::format(record);
-        file_ << data << std::flush;
-        current_size_ += data.length();
+    virtual void flush()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        file_.flush();
     }
 
 private:
@@ -187,9 +667,8 @@ private:
         }
 
         char today_buf[64];
-        time_t now = time(NULL);
         struct tm t;
-        log_util::localtime_s(&t, &now);
+        log_util::localtime_s(&t, &today_);
         strftime(today_buf, sizeof(today_buf), "%Y%m%d", &t);
 
         std::ostringstream  ss;
@@ -200,7 +679,11 @@ private:
         ss << ".log";
 
         std::string file_name = ss.str();
-        if (log_util::file_exists(file_name) && log_util::file_size(file_name) >= max_size_) {
+        bool used = log_util::file_exists(file_name) && log_util::file_size(file_name) >= max_size_;
+#ifdef DLOG_GZIP
+        used = used || log_util::file_exists(file_name + ".gz");    //已经压缩过的
+#endif
+        if (used) {
             backup_count_ += 1;
             return calc_file_name();
         }
@@ -208,38 +691,66 @@ private:
     }
 
 public:
+    //写线程在write_batch中持锁读这些成员, 因此设置和读取都要加锁
     void set_current_size(int s) {
+        std::lock_guard<std::mutex> lock(mutex_);
         current_size_ = s;
     }
 
     void set_max_size(int s) {
+        std::lock_guard<std::mutex> lock(mutex_);
         max_size_ = s;
     }
 
     void set_log_path(const std::string& s) {
+        std::lock_guard<std::mutex> lock(mutex_);
         log_path_ = s;
     }
 
     void set_module(const std::string& s) {
+        std::lock_guard<std::mutex> lock(mutex_);
         module_ = s;
     }
 
+    void set_flush_policy(const Flush_Policy& policy) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        policy_ = policy;
+    }
+
+#ifdef DLOG_GZIP
+    //换文件(按天或按大小)时把关闭的文件压缩成xxx.log.gz
+    void set_compress(bool compress) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        compress_ = compress;
+    }
+#endif
+
     int current_size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
         return current_size_;
     }
 
     int max_size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
         return max_size_;
     }
 
     std::string log_path() const {
+        std::lock_guard<std::mutex> lock(mutex_);
         return log_path_;
     }
 
     std::string module() const {
+        std::lock_guard<std::mutex> lock(mutex_);
         return module_;
     }
 
+    //写文件失败而丢弃的字节数
+    uint64_t lost_bytes() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return file_.lost_bytes();
+    }
+
 private:
     int         current_size_;  //当前文件大小
     int         max_size_;      //文件的最大大小，单位:字节
@@ -247,9 +758,393 @@ private:
     std::string log_path_;      //日志目录
     std::string module_;        //模块名
     time_t      today_;         //当前日期
-    std::ofstream file_;
+    time_t      day_end_;       //today_之后的下一个0点, 到了就换文件
+    Flush_Policy policy_;
+    mutable std::mutex mutex_;
+    Log_File    file_;
+#ifdef DLOG_GZIP
+    bool        compress_;
+    std::string file_name_;     //当前打开的文件
+    Log_Compressor compressor_; //最后一个成员, 最先析构: 等压缩做完
+#endif
+};
+
+
+//二进制日志文件, 格式见plog_binary.h, 用plog_decode转成文本.
+//每个调用点(文件名、函数名的指针及行号)只在第一次出现时写一次文件名和函数名, 之后每条日志只写调用点编号和参数.
+//定义了DLOG_BINARY_RECORD时参数直接复制, 否则整条消息作为一个字符串参数
+class Binary_File_Appender : public IAppender
+{
+public:
+    explicit Binary_File_Appender(const char* file_name)
+        : file_(fopen(file_name, "ab"))
+        , next_site_(1)
+    {
+        if (!file_) {
+            std::cerr << "open file failed: " << file_name;
+            return;
+        }
+        fwrite(log_binary::FILE_MAGIC, 1, sizeof(log_binary::FILE_MAGIC), file_);
+    }
+
+    ~Binary_File_Appender()
+    {
+        if (file_) {
+            fclose(file_);
+        }
+    }
+
+    virtual void write(const Record& record)
+    {
+        const Record* p = &record;
+        write_batch(&p, 1);
+    }
+
+    virtual void write_batch(const Record* const* records, size_t count)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!file_) {
+            return;
+        }
+
+        buf_.clear();
+        for (size_t i = 0; i < count; ++i) {
+            encode(*records[i]);
+        }
+        fwrite(buf_.data(), 1, buf_.size(), file_);
+    }
+
+    virtual void flush()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (file_) {
+            fflush(file_);
+        }
+    }
+
+private:
+    struct Site_Key {
+        const char* file;
+        const char* func;
+        size_t      line;
+
+        bool operator==(const Site_Key& other) const {
+            return file == other.file && func == other.func && line == other.line;
+        }
+    };
+
+    struct Site_Hash {
+        size_t operator()(const Site_Key& k) const {
+            return std::hash<const void*>()(k.file) ^ (std::hash<const void*>()(k.func) << 1) ^ (k.line << 7);
+        }
+    };
+
+    void encode(const Record& record)
+    {
+        using log_binary::put_raw;
+
+        Site_Key key = { record.getFileName(), record.getRawFunc(), record.getLine() };
+        uint32_t& site = sites_[key];
+        if (site == 0) {
+            site = next_site_++;
+            buf_.push_back(static_cast<char>(log_binary::ENTRY_SITE));
+            put_raw(buf_, site);
+            put_raw(buf_, static_cast<uint32_t>(key.line));
+            put_string16(key.file, strlen(key.file));
+            put_string16(key.func, strlen(key.func));
+        }
+
+        buf_.push_back(static_cast<char>(log_binary::ENTRY_RECORD));
+        put_raw(buf_, site);
+        put_raw(buf_, static_cast<uint8_t>(record.getSeverity()));
+        put_raw(buf_, static_cast<int64_t>(record.getTime().time));
+        put_raw(buf_, static_cast<uint16_t>(record.getTime().millitm));
+        put_raw(buf_, static_cast<uint32_t>(record.getTid()));
+
+        size_t len_pos = buf_.size();
+        put_raw(buf_, static_cast<uint32_t>(0));
+        record.getArgs(buf_);
+        uint32_t len = static_cast<uint32_t>(buf_.size() - len_pos - sizeof(uint32_t));
+        memcpy(&buf_[len_pos], &len, sizeof(len));
+    }
+
+    void put_string16(const char* s, size_t n)
+    {
+        if (n > 0xffff) {
+            n = 0xffff;
+        }
+        log_binary::put_raw(buf_, static_cast<uint16_t>(n));
+        buf_.append(s, n);
+    }
+
+private:
+    std::mutex  mutex_;
+    FILE*       file_;
+    uint32_t    next_site_;
+    std::string buf_;
+    std::unordered_map<Site_Key, uint32_t, Site_Hash> sites_;
 };
 
+#ifdef DLOG_HAS_MMAP
+//写到内存映射文件: 文件预先分配file_size字节并映射, 每次写用原子的写偏移领取一段空间, 然后memcpy,
+//不需要系统调用; 数据在page cache中, 进程崩溃也不会丢. 先写name.log, 写满后换下一个文件name.1.log, name.2.log...
+//(已存在的文件跳过, 不覆盖)
+//  1. 多个线程可以同时写(不经过独立的写线程时); 每个映射有引用计数, 换文件后旧映射等最后一个写者离开才解除
+//  2. 正常换文件/析构时文件截断到实际写入的大小; 崩溃留下的文件末尾是0, 读的时候去掉即可
+//  3. 一批日志格式化到本线程的缓冲区后只领取一次空间. 超过file_size的一批丢弃, 计入dropped()
+//  4. 打开新文件失败(如磁盘满)后RETRY_MS毫秒内不再尝试, 期间的日志丢弃, 计入dropped()
+template<class Formatter>
+class Mmap_File_Appender : public IAppender
+{
+public:
+    enum {
+        RETRY_MS = 1000,
+    };
+
+    explicit Mmap_File_Appender(const char* file_name, size_t file_size = 64 * 1024 * 1024)
+        : file_size_((std::max)(file_size, static_cast<size_t>(4096)))
+        , next_number_(0)
+        , current_(nullptr)
+        , dropped_(0)
+    {
+        const char* dot = std::strrchr(file_name, '.');
+        if (dot) {
+            name_no_ext_.assign(file_name, dot);
+            ext_.assign(dot + 1);
+        } else {
+            name_no_ext_.assign(file_name);
+        }
+
+        roll(nullptr);
+    }
+
+    ~Mmap_File_Appender()
+    {
+        Mapping* m = current_.load();
+        if (m) {
+            retire(m);
+        }
+        for (size_t i = 0; i < mappings_.size(); ++i) {
+            delete mappings_[i];
+        }
+    }
+
+    virtual void write(const Record& record)
+    {
+        const Record* p = &record;
+        write_batch(&p, 1);
+    }
+
+    virtual void write_batch(const Record* const* records, size_t count)
+    {
+        static thread_local std::string buf;
+        buf.clear();
+        for (size_t i = 0; i < count; ++i) {
+            Formatter::format_to(*records[i], buf);
+        }
+        append(buf.data(), buf.size());
+    }
+
+    //因写不下或换文件失败丢弃的批数
+    uint64_t dropped() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Mapping {
+        char*               base;
+        size_t              size;
+        int                 fd;
+        std::atomic<size_t> offset;     //写偏移, 可能超过size(写不下的那些)
+        std::atomic<size_t> data_end;   //第一段写不下的开始位置, 也就是有效数据的末尾
+        std::atomic<int>    refs;       //正在memcpy的写者数
+        std::atomic<bool>   retired;    //已换成下一个文件
+        std::atomic<bool>   unmapped;
+    };
+
+    void append(const char* data, size_t len)
+    {
+        if (len == 0) {
+            return;
+        }
+        if (len > file_size_) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        for (;;) {
+            Mapping* m = acquire();
+            if (!m) {
+                if (roll(nullptr) != 0) {   //之前打开失败, 过了RETRY_MS再试
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                continue;
+            }
+
+            size_t off = m->offset.fetch_add(len);
+            if (off + len <= m->size) {
+                memcpy(m->base + off, data, len);
+                release(m);
+                return;
+            }
+
+            if (off <= m->size) {
+                m->data_end.store(off);     //只有跨过末尾的那一个写者走到这里
+            }
+            release(m);
+            if (roll(m) != 0) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+    }
+
+    //引用当前映射. 先加引用再确认还是当前的, 和retire中先换current_再看引用数配合, 被引用的映射不会解除
+    Mapping* acquire()
+    {
+        for (;;) {
+            Mapping* m = current_.load();
+            if (!m) {
+                return nullptr;
+            }
+            m->refs.fetch_add(1);
+            if (current_.load() == m) {
+                return m;
+            }
+            release(m);
+        }
+    }
+
+    void release(Mapping* m)
+    {
+        if (m->refs.fetch_sub(1) == 1 && m->retired.load()) {
+            unmap(m);
+        }
+    }
+
+    //full写满了(为nullptr时是还没有打开的文件), 换下一个文件. 返回0为成功.
+    //失败后RETRY_MS毫秒内直接返回失败, 不会每条日志都去创建、预分配一个文件
+    int roll(Mapping* full)
+    {
+        std::lock_guard<std::mutex> lock(roll_mutex_);
+        if (current_.load() != full) {
+            return 0;   //别的线程已经换了
+        }
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now < retry_at_) {
+            return -1;
+        }
+
+        Mapping* m = open_mapping();
+        if (!m) {
+            retry_at_ = now + std::chrono::milliseconds(RETRY_MS);
+            return -1;
+        }
+        current_.store(m);
+        if (full) {
+            retire(full);
+        }
+        return 0;
+    }
+
+    void retire(Mapping* m)
+    {
+        m->retired.store(true);
+        if (m->refs.load() == 0) {
+            unmap(m);
+        }
+    }
+
+    //解除映射并把文件截断到实际写入的大小, 只执行一次
+    void unmap(Mapping* m)
+    {
+        if (m->unmapped.exchange(true)) {
+            return;
+        }
+        size_t end = (std::min)((std::min)(m->offset.load(), m->data_end.load()), m->size);
+        ::munmap(m->base, m->size);
+        if (::ftruncate(m->fd, static_cast<off_t>(end)) != 0) {
+            //截断失败只是文件末尾多了一些0
+        }
+        ::close(m->fd);
+    }
+
+    //打开下一个不存在的文件(编号0为name.log), 预分配并映射. 在roll_mutex_中调用
+    Mapping* open_mapping()
+    {
+        std::string name;
+        int fd = -1;
+        while (fd < 0) {
+            std::stringstream ss;
+            ss << name_no_ext_;
+            if (next_number_ > 0) {
+                ss << '.' << next_number_;
+            }
+            ++next_number_;
+            if (!ext_.empty()) {
+                ss << '.' << ext_;
+            }
+            name = ss.str();
+            fd = ::open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+            if (fd < 0 && errno != EEXIST) {
+                std::cerr << "open file failed: " << name;
+                return nullptr;
+            }
+        }
+
+#ifdef __linux__
+        int ret = ::posix_fallocate(fd, 0, static_cast<off_t>(file_size_));    //先占住磁盘, 写的时候不会因为磁盘满收到SIGBUS
+#else
+        int ret = ::ftruncate(fd, static_cast<off_t>(file_size_));
+#endif
+        void* base = ret == 0 ? ::mmap(NULL, file_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+        if (base == MAP_FAILED) {
+            std::cerr << "map file failed: " << name;
+            ::close(fd);
+            ::unlink(name.c_str());
+            --next_number_;     //下次重试还用这个编号
+            return nullptr;
+        }
+
+        Mapping* m = new Mapping;
+        m->base = static_cast<char*>(base);
+        m->size = file_size_;
+        m->fd   = fd;
+        m->offset.store(0);
+        m->data_end.store(static_cast<size_t>(-1));
+        m->refs.store(0);
+        m->retired.store(false);
+        m->unmapped.store(false);
+
+        const std::string& header = Formatter::header();
+        if (!header.empty() && header.size() <= m->size) {
+            memcpy(m->base, header.data(), header.size());
+            m->offset.store(header.size());
+        }
+
+        mappings_.push_back(m);     //写者可能还拿着旧映射的指针, Mapping本身到析构时才释放
+        return m;
+    }
+
+private:
+    Mmap_File_Appender(const Mmap_File_Appender&);
+    Mmap_File_Appender& operator=(const Mmap_File_Appender&);
+
+private:
+    const size_t            file_size_;
+    std::string             name_no_ext_;
+    std::string             ext_;
+    unsigned                next_number_;       //由roll_mutex_保护
+    std::chrono::steady_clock::time_point retry_at_;   //打开失败后到这个时间才再试, 由roll_mutex_保护
+    std::mutex              roll_mutex_;
+    std::vector<Mapping*>   mappings_;          //由roll_mutex_保护
+    std::atomic<Mapping*>   current_;
+    std::atomic<uint64_t>   dropped_;
+};
+#endif
+
 
 DLOG_NAMESPACE_END
 
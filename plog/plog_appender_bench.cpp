@@ -0,0 +1,86 @@
+//文件appender的吞吐: 多个线程写LOG_INFO, 计时到最后一次flush写完, 比较不同的Flush_Policy
+//编译: g++ -std=c++11 -O2 -pthread plog_appender_bench.cpp -o plog_appender_bench
+//用法: plog_appender_bench ds|rolling line|batch|buffered [线程数] [每个线程的条数]
+//  line:     每条日志一次write, 同以前Date_Size每条flush的行为(逐条调用appender的write)
+//  batch:    写线程取到的每一批一次write, Date_Size的默认值
+//  buffered: 64K/200ms或error级别才写, Rolling的默认值
+//在当前目录下生成bench_log/和bench.txt, 每次运行前删除
+
+#include "plog_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace NS_DLOG;
+
+//不重写write_batch, 写线程的一批日志逐条调用write
+class Per_Line_Appender : public IAppender
+{
+public:
+    explicit Per_Line_Appender(const std::shared_ptr<IAppender>& appender) : appender_(appender) {}
+
+    virtual void write(const Record& record) {
+        appender_->write(record);
+    }
+
+    virtual void flush() {
+        appender_->flush();
+    }
+
+private:
+    std::shared_ptr<IAppender> appender_;
+};
+
+int main(int argc, char** argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s ds|rolling line|batch|buffered [threads] [lines]\n", argv[0]);
+        return 1;
+    }
+    std::string kind    = argv[1];
+    std::string mode    = argv[2];
+    int         threads = argc > 3 ? atoi(argv[3]) : 4;
+    int         lines   = argc > 4 ? atoi(argv[4]) : 125000;
+
+    Flush_Policy policy;
+    if (mode == "line" || mode == "batch") {
+        policy = Flush_Policy::every_batch();
+    }
+
+    if (system("rm -rf bench_log bench.txt bench.*.txt") != 0) {
+        return 1;
+    }
+
+    std::shared_ptr<IAppender> appender;
+    if (kind == "ds") {
+        appender = std::make_shared<Date_Size_File_Appender<TxtFormatter> >("./bench_log", "bench", 1 << 30, policy);
+    } else {
+        appender = std::make_shared<Rolling_File_Appender<TxtFormatter> >("bench.txt", 1 << 30, 2, policy);
+    }
+    if (mode == "line") {
+        appender = std::make_shared<Per_Line_Appender>(appender);
+    }
+    Logger<PLOG_DEFAULT_INSTANCE>& logger = init(debug, appender);
+
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.push_back(std::thread([t, lines] {
+            for (int i = 0; i < lines; ++i) {
+                LOG_INFO << "thread " << t << " request " << i << " took " << 1.25 * i << " ms";
+            }
+        }));
+    }
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+    logger.flush();
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    printf("%-8s %-9s %d x %d  %10.0f lines/s  (%.2f s)\n",
+           kind.c_str(), mode.c_str(), threads, lines, threads * lines / s, s);
+    return 0;
+}
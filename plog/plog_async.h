@@ -0,0 +1,325 @@
+#ifndef _PLOG_ASYNC_H_
+#define _PLOG_ASYNC_H_
+
+//日志的异步后端: 一个有界的MPSC环形队列 + 一个写线程
+//  1. 每个槽位放一个T(Record), 写日志的线程用CAS领取槽位后把Record移动进去, 不加锁、不分配内存
+//  2. 写线程按顺序一次取走所有就绪的槽位(最多BATCH_SIZE个), 整批交给sink(即各appender的write_batch)
+//  3. 队列满时按Overflow_Policy阻塞或丢弃(计数)
+//  4. flush()是一个屏障: 返回时, 调用flush之前提交的日志都已交给sink, 并调用过flush_sink
+//  5. 空闲IDLE_MS毫秒没有新日志时也调用一次flush_sink, appender缓存的日志不会一直留着
+//  6. 析构时先拒绝新的push, 再等所有已领取的槽位写入并交给sink后才退出, 不会丢日志
+//用法(Logger内部使用):
+//  Async_Ring<Record> ring(8192, [](Record* const* records, size_t n) { ... }, [] { ... });
+//  ring.push(record);
+//  ring.flush();
+
+#include "../config.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <utility>
+#include <stdint.h>
+
+DLOG_NAMESPACE_BEGIN
+
+//队列满时的处理方式
+enum Async_Overflow_Policy {
+    ASYNC_BLOCK,        //写日志的线程等待, 直到有空位. 写线程自己(appender中写日志)不等待, 丢弃
+    ASYNC_DROP,         //丢弃这条日志, 计入dropped()
+};
+
+template<typename T>
+class Async_Ring
+{
+public:
+    typedef std::function<void(T* const* items, size_t count)> Sink;
+    typedef std::function<void()> Flush_Sink;
+
+    enum {
+        BATCH_SIZE = 256,       //写线程每次最多交给sink的条数
+        IDLE_MS    = 100,       //写线程空闲多久调用一次flush_sink
+    };
+
+    //capacity向上取整为2的幂
+    Async_Ring(size_t capacity, Sink sink, Flush_Sink flush_sink = Flush_Sink())
+        : sink_(sink)
+        , flush_sink_(flush_sink)
+        , policy_(ASYNC_BLOCK)
+        , enqueue_pos_(0)
+        , dequeue_pos_(0)
+        , written_pos_(0)
+        , flushed_pos_(0)
+        , dropped_(0)
+        , writer_sleeping_(false)
+        , blocked_(0)
+        , pushers_(0)
+        , flush_waiters_(0)
+        , stopping_(false)
+    {
+        size_t n = 2;
+        while (n < capacity) {
+            n <<= 1;
+        }
+        mask_ = n - 1;
+        cells_ = new Cell[n];
+        for (size_t i = 0; i < n; ++i) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+
+        writer_    = std::thread(&Async_Ring::run, this);
+        writer_id_ = writer_.get_id();
+    }
+
+    //写完队列中剩余的日志后退出. 析构开始后的push返回false
+    ~Async_Ring()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_.store(true);
+        }
+        writer_cv_.notify_one();
+        writer_.join();
+        delete[] cells_;
+    }
+
+    void set_overflow_policy(Async_Overflow_Policy policy) {
+        policy_ = policy;
+    }
+
+    Async_Overflow_Policy overflow_policy() const {
+        return policy_;
+    }
+
+    size_t capacity() const {
+        return mask_ + 1;
+    }
+
+    //因队列满被丢弃的条数
+    uint64_t dropped() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+    //提交成功时item被移走, 返回true; 被丢弃时返回false, item不变
+    bool push(T& item)
+    {
+        //pushers_和stopping_构成Dekker式检查: 要么这里看到stopping_, 要么写线程看到pushers_ > 0而不退出.
+        //减pushers_之后不能再访问成员
+        pushers_.fetch_add(1);
+        if (stopping_.load()) {
+            pushers_.fetch_sub(1);
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        bool ok = push_slow(item);
+        pushers_.fetch_sub(1);
+        return ok;
+    }
+
+    //等待之前提交的日志全部写出. 在写线程中(appender里)调用时直接返回
+    void flush()
+    {
+        if (std::this_thread::get_id() == writer_id_) {
+            return;
+        }
+
+        size_t ticket = enqueue_pos_.load(std::memory_order_acquire);
+        std::unique_lock<std::mutex> lock(mutex_);
+        ++flush_waiters_;
+        writer_cv_.notify_one();
+        flush_cv_.wait(lock, [this, ticket] {
+            return static_cast<intptr_t>(this->flushed_pos_.load() - ticket) >= 0;
+        });
+        --flush_waiters_;
+    }
+
+private:
+    bool push_slow(T& item)
+    {
+        if (try_push(item)) {
+            return true;
+        }
+
+        if (policy_ == ASYNC_DROP || std::this_thread::get_id() == writer_id_) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        //ASYNC_BLOCK: 写线程处理完一批后通知. try_push会去锁mutex_唤醒写线程, 因此不能持锁调用;
+        //检查和等待之间的通知可能错过, 超时兜底
+        ++blocked_;
+        while (!try_push(item)) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_full_cv_.wait_for(lock, std::chrono::milliseconds(1));
+        }
+        --blocked_;
+        return true;
+    }
+
+    struct Cell {
+        std::atomic<size_t> seq;    //等于pos: 空闲, 可写入; 等于pos+1: 已写入, 可读
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    bool try_push(T& item)
+    {
+        Cell* cell;
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (dif == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return false;   //满了
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        ::new (static_cast<void*>(&cell->storage)) T(std::move(item));
+        cell->seq.store(pos + 1, std::memory_order_release);
+
+        //写线程在休眠才需要唤醒. 和run中的writer_sleeping_/ready()构成Dekker式检查, 不会丢失唤醒
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (writer_sleeping_.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            writer_cv_.notify_one();
+        }
+        return true;
+    }
+
+    bool ready() const
+    {
+        const Cell& cell = cells_[dequeue_pos_ & mask_];
+        return cell.seq.load(std::memory_order_acquire) == dequeue_pos_ + 1;
+    }
+
+    //只在写线程中调用. 返回处理的条数
+    size_t drain()
+    {
+        T* items[BATCH_SIZE];
+        size_t total = 0;
+
+        for (;;) {
+            size_t n = 0;
+            while (n < BATCH_SIZE) {
+                Cell& cell = cells_[(dequeue_pos_ + n) & mask_];
+                if (cell.seq.load(std::memory_order_acquire) != dequeue_pos_ + n + 1) {
+                    break;
+                }
+                items[n++] = reinterpret_cast<T*>(&cell.storage);
+            }
+            if (n == 0) {
+                break;
+            }
+
+            sink_(items, n);
+
+            for (size_t i = 0; i < n; ++i) {
+                items[i]->~T();
+                cells_[(dequeue_pos_ + i) & mask_].seq.store(dequeue_pos_ + i + mask_ + 1, std::memory_order_release);
+            }
+            dequeue_pos_ += n;
+            written_pos_.store(dequeue_pos_, std::memory_order_release);
+            total += n;
+
+            if (blocked_ > 0) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                not_full_cv_.notify_all();
+            }
+        }
+        return total;
+    }
+
+    void run()
+    {
+        for (;;) {
+            drain();
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (flush_waiters_ > 0 && flushed_pos_.load() != written_pos_.load()) {
+                lock.unlock();
+                if (flush_sink_) {
+                    flush_sink_();
+                }
+                lock.lock();
+                flushed_pos_.store(written_pos_.load());
+                flush_cv_.notify_all();
+                continue;
+            }
+
+            bool idle = false;
+            writer_sleeping_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!ready()) {
+                //停止时, 没有正在push的线程且已领取的槽位都已处理完才退出
+                bool stopping = stopping_.load();
+                if (stopping && pushers_.load() == 0 && enqueue_pos_.load() == dequeue_pos_) {
+                    writer_sleeping_.store(false);
+                    break;
+                }
+                //flush等待或停止时, 还没写到的日志可能只是领取了槽位还没写入, 醒来重试
+                idle = writer_cv_.wait_for(lock, std::chrono::milliseconds(flush_waiters_ > 0 || stopping ? 1 : int(IDLE_MS)))
+                       == std::cv_status::timeout;
+            }
+            writer_sleeping_.store(false);
+
+            if (idle && !ready() && flushed_pos_.load() != written_pos_.load()) {
+                lock.unlock();
+                if (flush_sink_) {
+                    flush_sink_();
+                }
+                lock.lock();
+                flushed_pos_.store(written_pos_.load());
+                flush_cv_.notify_all();
+            }
+        }
+
+        if (flush_sink_) {
+            flush_sink_();
+        }
+        flushed_pos_.store(written_pos_.load());
+    }
+
+private:
+    Async_Ring(const Async_Ring&);
+    Async_Ring& operator=(const Async_Ring&);
+
+private:
+    Cell*                   cells_;
+    size_t                  mask_;
+    Sink                    sink_;
+    Flush_Sink              flush_sink_;
+    Async_Overflow_Policy   policy_;
+
+    std::atomic<size_t>     enqueue_pos_;       //生产者领取槽位的位置
+    size_t                  dequeue_pos_;       //只有写线程访问
+    std::atomic<size_t>     written_pos_;       //已交给sink的位置
+    std::atomic<size_t>     flushed_pos_;       //调用flush_sink时的written_pos_
+    std::atomic<uint64_t>   dropped_;
+    std::atomic<bool>       writer_sleeping_;
+
+    std::mutex              mutex_;             //只用于休眠/唤醒, 不在写日志的快速路径上
+    std::condition_variable writer_cv_;
+    std::condition_variable not_full_cv_;
+    std::condition_variable flush_cv_;
+    std::atomic<int>        blocked_;           //ASYNC_BLOCK下等待的生产者数
+    std::atomic<int>        pushers_;           //正在push中的生产者数
+    int                     flush_waiters_;     //由mutex_保护
+    std::atomic<bool>       stopping_;          //在mutex_下置位, push中无锁读取
+
+    std::thread             writer_;
+    std::thread::id         writer_id_;
+};
+
+DLOG_NAMESPACE_END
+
+#endif
@@ -0,0 +1,330 @@
+#ifndef _PLOG_BINARY_H_
+#define _PLOG_BINARY_H_
+
+//二进制日志: 参数不格式化, 按类型标记 + 原始字节存放, 到写线程(或离线用plog_decode)才转成文本
+//  参数编码: 1字节类型 + 数据
+//      ARG_INT64/ARG_UINT64/ARG_DOUBLE/ARG_POINTER: 8字节
+//      ARG_CHAR/ARG_BOOL: 1字节
+//      ARG_STRING: 4字节长度 + 内容
+//  文件格式(Binary_File_Appender): 文件头FILE_MAGIC, 之后是一条条的项, 每项1字节类型:
+//      ENTRY_SITE:   u32 site_id, u32 line, u16 file长度, file, u16 func长度, func    --每个调用点第一次出现时写一次
+//      ENTRY_RECORD: u32 site_id, u8 severity, i64 time, u16 millitm, u32 tid, u32 参数长度, 参数
+//  整数按本机字节序保存, 解码要在同样字节序的机器上
+//  追加到已有文件时会再写一次文件头, 解码时遇到文件头就清空调用点表
+
+#include "../config.h"
+#include "plog_buffer.h"
+#include <string>
+#include <sstream>
+#include <type_traits>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+DLOG_NAMESPACE_BEGIN
+
+namespace log_binary {
+
+enum Arg_Type {
+    ARG_INT64 = 1,
+    ARG_UINT64,
+    ARG_DOUBLE,
+    ARG_CHAR,
+    ARG_BOOL,
+    ARG_STRING,
+    ARG_POINTER,
+};
+
+enum Entry_Type {
+    ENTRY_SITE = 1,
+    ENTRY_RECORD,
+};
+
+static const char FILE_MAGIC[8] = { 'D', 'L', 'O', 'G', 'B', 'I', 'N', '1' };
+
+template<typename Buffer, typename T>
+inline void put_raw(Buffer& buf, T v)
+{
+    buf.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+template<typename T>
+inline bool get_raw(const char*& p, const char* end, T& v)
+{
+    if (end - p < static_cast<ptrdiff_t>(sizeof(v))) {
+        return false;
+    }
+    memcpy(&v, p, sizeof(v));
+    p += sizeof(v);
+    return true;
+}
+
+//把operator<<的参数编码后追加到buf(Log_Buffer或std::string)中. 解码后的文本和Text_Writer一致
+template<typename Buffer>
+class Arg_Writer
+{
+public:
+    explicit Arg_Writer(Buffer& buf) : buf_(buf) {}
+
+    void put(bool v)                { put_tag(ARG_BOOL); buf_.push_back(v ? 1 : 0); }
+    void put(char v)                { put_tag(ARG_CHAR); buf_.push_back(v); }
+    void put(signed char v)         { put(static_cast<char>(v)); }
+    void put(unsigned char v)       { put(static_cast<char>(v)); }
+    void put(short v)               { put_int(v); }
+    void put(int v)                 { put_int(v); }
+    void put(long v)                { put_int(v); }
+    void put(long long v)           { put_int(v); }
+    void put(unsigned short v)      { put_uint(v); }
+    void put(unsigned int v)        { put_uint(v); }
+    void put(unsigned long v)       { put_uint(v); }
+    void put(unsigned long long v)  { put_uint(v); }
+    void put(float v)               { put_double(v); }
+    void put(double v)              { put_double(v); }
+    void put(long double v)         { put_double(static_cast<double>(v)); }
+
+    void put(const char* v)
+    {
+        put_string(v ? v : "(null)", v ? strlen(v) : 6);
+    }
+
+    void put(char* v) {
+        put(static_cast<const char*>(v));
+    }
+
+    void put(const std::string& v)
+    {
+        if (v.empty()) {
+            put_string("(null)", 6);
+        } else {
+            put_string(v.data(), v.size());
+        }
+    }
+
+    void put(const void* v)
+    {
+        put_tag(ARG_POINTER);
+        put_raw(buf_, static_cast<uint64_t>(reinterpret_cast<uintptr_t>(v)));
+    }
+
+    //其它类型: 指针按地址保存, 其余的只能在调用线程用operator<<格式化成字符串
+    template<typename T>
+    void put(const T& v)
+    {
+        put_other(v, std::is_pointer<T>());
+    }
+
+    void put_string(const char* s, size_t n)
+    {
+        put_tag(ARG_STRING);
+        put_raw(buf_, static_cast<uint32_t>(n));
+        buf_.append(s, n);
+    }
+
+private:
+    void put_tag(Arg_Type t) {
+        buf_.push_back(static_cast<char>(t));
+    }
+
+    void put_int(long long v) {
+        put_tag(ARG_INT64);
+        put_raw(buf_, static_cast<int64_t>(v));
+    }
+
+    void put_uint(unsigned long long v) {
+        put_tag(ARG_UINT64);
+        put_raw(buf_, static_cast<uint64_t>(v));
+    }
+
+    void put_double(double v) {
+        put_tag(ARG_DOUBLE);
+        put_raw(buf_, v);
+    }
+
+    template<typename T>
+    void put_other(const T& v, std::true_type) {
+        put(static_cast<const void*>(v));
+    }
+
+    template<typename T>
+    void put_other(const T& v, std::false_type) {
+        std::stringstream ss;
+        ss << v;
+        const std::string& s = ss.str();
+        put_string(s.data(), s.size());
+    }
+
+private:
+    Buffer& buf_;
+};
+
+//解码出的一个参数. 字符串指向编码数据, 不复制
+struct Arg_Value
+{
+    int         type;       //Arg_Type
+    int64_t     i;          //ARG_INT64
+    uint64_t    u;          //ARG_UINT64, ARG_POINTER
+    double      d;          //ARG_DOUBLE
+    char        c;          //ARG_CHAR, ARG_BOOL
+    const char* str;        //ARG_STRING
+    uint32_t    len;
+};
+
+//从p解码一个参数, p移到下一个. 数据不完整或类型不对时返回false
+inline bool next_arg(const char*& p, const char* end, Arg_Value& v)
+{
+    if (p >= end) {
+        return false;
+    }
+    v.type = static_cast<unsigned char>(*p++);
+    switch (v.type) {
+    case ARG_INT64:
+        return get_raw(p, end, v.i);
+    case ARG_UINT64:
+    case ARG_POINTER:
+        return get_raw(p, end, v.u);
+    case ARG_DOUBLE:
+        return get_raw(p, end, v.d);
+    case ARG_CHAR:
+    case ARG_BOOL:
+        return get_raw(p, end, v.c);
+    case ARG_STRING:
+        if (!get_raw(p, end, v.len) || end - p < static_cast<ptrdiff_t>(v.len)) {
+            return false;
+        }
+        v.str = p;
+        p += v.len;
+        return true;
+    default:
+        return false;
+    }
+}
+
+//一个参数按operator<<的格式转成文本, 追加到out
+inline void append_arg_text(const Arg_Value& v, std::string& out)
+{
+    char num[32];
+    switch (v.type) {
+    case ARG_INT64:
+        out.append(num, log_format::format_int(num, v.i));
+        break;
+    case ARG_UINT64:
+        out.append(num, log_format::format_uint(num, v.u));
+        break;
+    case ARG_DOUBLE:
+        out.append(num, log_format::format_double(num, v.d));
+        break;
+    case ARG_CHAR:
+        if (v.c != '\0') {     //同Text_Writer
+            out += v.c;
+        }
+        break;
+    case ARG_BOOL:
+        out += v.c ? '1' : '0';
+        break;
+    case ARG_STRING:
+        out.append(v.str, v.len);
+        break;
+    case ARG_POINTER:
+        out.append(num, log_format::format_pointer(num, v.u));
+        break;
+    }
+}
+
+//一个参数作为JSON的值: 整数、浮点数(nan/inf为null)、true/false按类型输出, 字符、字符串、指针输出为字符串
+inline void append_arg_json(const Arg_Value& v, std::string& out)
+{
+    char num[32];
+    switch (v.type) {
+    case ARG_DOUBLE:
+        if (v.d != v.d || v.d - v.d != 0) {
+            out.append("null", 4);
+        } else {
+            out.append(num, log_format::format_double(num, v.d));
+        }
+        break;
+    case ARG_BOOL:
+        if (v.c) {
+            out.append("true", 4);
+        } else {
+            out.append("false", 5);
+        }
+        break;
+    case ARG_CHAR:
+        out += '"';
+        log_format::append_json_escaped(out, &v.c, 1);
+        out += '"';
+        break;
+    case ARG_STRING:
+        out += '"';
+        log_format::append_json_escaped(out, v.str, v.len);
+        out += '"';
+        break;
+    case ARG_POINTER:
+        out += '"';
+        out.append(num, log_format::format_pointer(num, v.u));
+        out += '"';
+        break;
+    default:
+        append_arg_text(v, out);
+        break;
+    }
+}
+
+//一个参数作为logfmt的值
+inline void append_arg_logfmt(const Arg_Value& v, std::string& out)
+{
+    switch (v.type) {
+    case ARG_BOOL:
+        if (v.c) {
+            out.append("true", 4);
+        } else {
+            out.append("false", 5);
+        }
+        break;
+    case ARG_CHAR:
+        log_format::append_logfmt_value(out, &v.c, 1);
+        break;
+    case ARG_STRING:
+        log_format::append_logfmt_value(out, v.str, v.len);
+        break;
+    default:
+        append_arg_text(v, out);
+        break;
+    }
+}
+
+//把编码后的参数转成文本, 追加到out. 数据不完整时返回false(已转换的部分保留在out中)
+inline bool decode_args(const char* p, size_t n, std::string& out)
+{
+    const char* end = p + n;
+    Arg_Value v;
+    while (p < end) {
+        if (!next_arg(p, end, v)) {
+            return false;
+        }
+        append_arg_text(v, out);
+    }
+    return true;
+}
+
+//Record的字段(见NS_DLOG::field): 每个字段是一个ARG_STRING的key加一个值
+class Field_Reader
+{
+public:
+    Field_Reader(const char* p, size_t n) : p_(p), end_(p + n) {}
+
+    bool next(Arg_Value& key, Arg_Value& value)
+    {
+        return next_arg(p_, end_, key) && key.type == ARG_STRING && next_arg(p_, end_, value);
+    }
+
+private:
+    const char* p_;
+    const char* end_;
+};
+
+} //namespace log_binary
+
+DLOG_NAMESPACE_END
+
+#endif
@@ -0,0 +1,329 @@
+#ifndef _PLOG_BUFFER_H_
+#define _PLOG_BUFFER_H_
+
+//Record的消息缓冲区及数字格式化
+//  Log_Buffer: 不超过Inline_Size字节时存放在对象内部, 超过时才转到堆上(spill), 一般的日志不分配内存
+//  Text_Writer: 按类型把operator<<的参数写成文本, 结果和写到std::stringstream(及log_util中的重载)一致.
+//               整数、浮点数用to_chars(C++17, 没有时用查表/snprintf), 不经过locale
+
+#include "../config.h"
+#include <string>
+#include <sstream>
+#include <type_traits>
+#include <utility>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#   if __has_include(<charconv>)
+#       include <charconv>
+#   endif
+#endif
+
+DLOG_NAMESPACE_BEGIN
+
+template<size_t Inline_Size>
+class Log_Buffer
+{
+public:
+    Log_Buffer() : size_(0), spill_(nullptr) {}
+
+    Log_Buffer(Log_Buffer&& other) noexcept
+        : size_(other.size_)
+        , spill_(other.spill_)
+    {
+        if (!spill_) {
+            memcpy(buf_, other.buf_, size_);     //只复制用到的部分
+        }
+        other.size_  = 0;
+        other.spill_ = nullptr;
+    }
+
+    ~Log_Buffer() {
+        delete spill_;
+    }
+
+    const char* data() const {
+        return spill_ ? spill_->data() : buf_;
+    }
+
+    size_t size() const {
+        return spill_ ? spill_->size() : size_;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    //是否已转到堆上
+    bool spilled() const {
+        return spill_ != nullptr;
+    }
+
+    void append(const char* s, size_t n)
+    {
+        if (!spill_ && size_ + n <= Inline_Size) {
+            memcpy(buf_ + size_, s, n);
+            size_ += n;
+            return;
+        }
+        spill();
+        spill_->append(s, n);
+    }
+
+    void push_back(char c)
+    {
+        if (!spill_ && size_ < Inline_Size) {
+            buf_[size_++] = c;
+            return;
+        }
+        spill();
+        spill_->push_back(c);
+    }
+
+private:
+    void spill()
+    {
+        if (!spill_) {
+            spill_ = new std::string(buf_, size_);
+        }
+    }
+
+    Log_Buffer(const Log_Buffer&);
+    Log_Buffer& operator=(const Log_Buffer&);
+
+private:
+    size_t       size_;
+    std::string* spill_;
+    char         buf_[Inline_Size];
+};
+
+namespace log_format {
+
+enum {
+    UINT_MAX_CHARS = 20,                    //unsigned long long最多20位十进制数
+    INT_MAX_CHARS  = UINT_MAX_CHARS + 1,    //加上负号
+};
+
+//返回写入的字符数, buf至少UINT_MAX_CHARS字节
+inline size_t format_uint(char* buf, unsigned long long v)
+{
+#if defined(__cpp_lib_to_chars)
+    return std::to_chars(buf, buf + UINT_MAX_CHARS, v).ptr - buf;
+#else
+    static const char digits[] =
+        "0001020304050607080910111213141516171819"
+        "2021222324252627282930313233343536373839"
+        "4041424344454647484950515253545556575859"
+        "6061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+    char tmp[24];
+    char* p = tmp + sizeof(tmp);
+    while (v >= 100) {
+        unsigned i = static_cast<unsigned>(v % 100) * 2;
+        v /= 100;
+        *--p = digits[i + 1];
+        *--p = digits[i];
+    }
+    if (v >= 10) {
+        unsigned i = static_cast<unsigned>(v) * 2;
+        *--p = digits[i + 1];
+        *--p = digits[i];
+    } else {
+        *--p = static_cast<char>('0' + v);
+    }
+    size_t n = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, n);
+    return n;
+#endif
+}
+
+//buf至少INT_MAX_CHARS字节
+inline size_t format_int(char* buf, long long v)
+{
+    if (v < 0) {
+        *buf = '-';
+        return 1 + format_uint(buf + 1, 0ULL - static_cast<unsigned long long>(v));
+    }
+    return format_uint(buf, static_cast<unsigned long long>(v));
+}
+
+//同ostream的默认格式(%g, precision 6), buf至少32字节
+inline size_t format_double(char* buf, double v)
+{
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    return std::to_chars(buf, buf + 32, v, std::chars_format::general, 6).ptr - buf;
+#else
+    int n = snprintf(buf, 32, "%g", v);
+    return n > 0 ? static_cast<size_t>(n) : 0;
+#endif
+}
+
+//指针同ostream: 0x开头的十六进制, 空指针为0
+inline size_t format_pointer(char* buf, uint64_t v)
+{
+    if (!v) {
+        *buf = '0';
+        return 1;
+    }
+    static const char hex[] = "0123456789abcdef";
+    char tmp[16];
+    int n = 0;
+    while (v) {
+        tmp[n++] = hex[v & 0xf];
+        v >>= 4;
+    }
+    buf[0] = '0';
+    buf[1] = 'x';
+    for (int i = 0; i < n; ++i) {
+        buf[2 + i] = tmp[n - 1 - i];
+    }
+    return 2 + n;
+}
+
+//JSON字符串的内容(不含两边的引号): 转义"、\和控制字符, 其余字节(包括UTF-8)原样复制
+inline void append_json_escaped(std::string& out, const char* s, size_t n)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t run = 0;     //不需要转义的一段, 整段复制
+    for (size_t i = 0; i < n; ++i) {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        out.append(s + run, i - run);
+        run = i + 1;
+        switch (c) {
+        case '"':  out.append("\\\"", 2); break;
+        case '\\': out.append("\\\\", 2); break;
+        case '\n': out.append("\\n", 2); break;
+        case '\r': out.append("\\r", 2); break;
+        case '\t': out.append("\\t", 2); break;
+        default: {
+            char u[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+            out.append(u, 6);
+            break;
+        }
+        }
+    }
+    out.append(s + run, n - run);
+}
+
+//logfmt的值: 空串或含空格、=、"、\、控制字符时加引号并按JSON的规则转义, 否则原样复制
+inline void append_logfmt_value(std::string& out, const char* s, size_t n)
+{
+    bool quote = n == 0;
+    for (size_t i = 0; i < n && !quote; ++i) {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        quote = c <= ' ' || c == '=' || c == '"' || c == '\\';
+    }
+    if (!quote) {
+        out.append(s, n);
+        return;
+    }
+    out += '"';
+    append_json_escaped(out, s, n);
+    out += '"';
+}
+
+} //namespace log_format
+
+//把参数写成文本追加到Buffer(Log_Buffer或std::string)
+template<typename Buffer>
+class Text_Writer
+{
+public:
+    explicit Text_Writer(Buffer& buf) : buf_(buf) {}
+
+    void put(bool v)                { buf_.push_back(v ? '1' : '0'); }
+    void put(char v)                { if (v != '\0') buf_.push_back(v); }    //同以前按C字符串输出: '\0'什么也不写
+    void put(signed char v)         { buf_.push_back(static_cast<char>(v)); }
+    void put(unsigned char v)       { buf_.push_back(static_cast<char>(v)); }
+    void put(short v)               { put_int(v); }
+    void put(int v)                 { put_int(v); }
+    void put(long v)                { put_int(v); }
+    void put(long long v)           { put_int(v); }
+    void put(unsigned short v)      { put_uint(v); }
+    void put(unsigned int v)        { put_uint(v); }
+    void put(unsigned long v)       { put_uint(v); }
+    void put(unsigned long long v)  { put_uint(v); }
+    void put(float v)               { put_double(v); }
+    void put(double v)              { put_double(v); }
+    void put(long double v)         { put_double(static_cast<double>(v)); }
+
+    void put(const char* v)
+    {
+        if (v) {
+            buf_.append(v, strlen(v));
+        } else {
+            buf_.append("(null)", 6);
+        }
+    }
+
+    void put(char* v) {
+        put(static_cast<const char*>(v));
+    }
+
+    void put(const std::string& v)
+    {
+        if (v.empty()) {
+            buf_.append("(null)", 6);
+        } else {
+            buf_.append(v.data(), v.size());
+        }
+    }
+
+    void put(const void* v)
+    {
+        char num[24];
+        buf_.append(num, log_format::format_pointer(num, static_cast<uint64_t>(reinterpret_cast<uintptr_t>(v))));
+    }
+
+    //其它类型: 指针按地址输出, 其余的用operator<<格式化(会分配内存)
+    template<typename T>
+    void put(const T& v)
+    {
+        put_other(v, std::is_pointer<T>());
+    }
+
+private:
+    void put_int(long long v)
+    {
+        char num[24];
+        buf_.append(num, log_format::format_int(num, v));
+    }
+
+    void put_uint(unsigned long long v)
+    {
+        char num[24];
+        buf_.append(num, log_format::format_uint(num, v));
+    }
+
+    void put_double(double v)
+    {
+        char num[32];
+        buf_.append(num, log_format::format_double(num, v));
+    }
+
+    template<typename T>
+    void put_other(const T& v, std::true_type) {
+        put(static_cast<const void*>(v));
+    }
+
+    template<typename T>
+    void put_other(const T& v, std::false_type) {
+        std::stringstream ss;
+        ss << v;
+        const std::string& s = ss.str();
+        buf_.append(s.data(), s.size());
+    }
+
+private:
+    Buffer& buf_;
+};
+
+DLOG_NAMESPACE_END
+
+#endif
@@ -0,0 +1,146 @@
+//把Binary_File_Appender写的二进制日志转成文本, 格式同TxtFormatter
+//编译: g++ -std=c++11 -O2 plog_decode.cpp -o plog_decode
+//用法: plog_decode file1.bin [file2.bin ...]      不带参数时从标准输入读
+
+#include "plog_logger.h"
+#include "plog_binary.h"
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+using namespace NS_DLOG;
+
+struct Site {
+    uint32_t    line;
+    std::string file;
+    std::string func;   //已经取出了短函数名
+};
+
+static bool read_string16(const char*& p, const char* end, std::string& s)
+{
+    uint16_t n;
+    if (!log_binary::get_raw(p, end, n) || end - p < n) {
+        return false;
+    }
+    s.assign(p, n);
+    p += n;
+    return true;
+}
+
+//返回0为成功
+static int decode(FILE* in, FILE* out, const char* name)
+{
+    std::vector<char> data;
+    char chunk[64 * 1024];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+
+    const char* p   = data.data();
+    const char* end = p + data.size();
+    std::unordered_map<uint32_t, Site> sites;
+    std::string line;
+    std::string message;
+
+    while (p < end) {
+        if (end - p >= static_cast<ptrdiff_t>(sizeof(log_binary::FILE_MAGIC)) &&
+            memcmp(p, log_binary::FILE_MAGIC, sizeof(log_binary::FILE_MAGIC)) == 0) {
+            sites.clear();      //新的一段, 调用点重新编号
+            p += sizeof(log_binary::FILE_MAGIC);
+            continue;
+        }
+
+        const char* entry = p;
+        int type = static_cast<unsigned char>(*p++);
+        if (type == log_binary::ENTRY_SITE) {
+            uint32_t id;
+            Site site;
+            std::string func;
+            if (!log_binary::get_raw(p, end, id) || !log_binary::get_raw(p, end, site.line) ||
+                !read_string16(p, end, site.file) || !read_string16(p, end, func)) {
+                p = entry;
+                break;
+            }
+            site.func = log_util::short_func_name(func.c_str());
+            sites[id] = site;
+            continue;
+        }
+        if (type != log_binary::ENTRY_RECORD) {
+            fprintf(stderr, "%s: bad entry type %d at offset %ld\n", name, type, static_cast<long>(entry - data.data()));
+            return -1;
+        }
+
+        uint32_t site_id, tid, args_len;
+        uint8_t  severity;
+        int64_t  time;
+        uint16_t millitm;
+        if (!log_binary::get_raw(p, end, site_id) || !log_binary::get_raw(p, end, severity) ||
+            !log_binary::get_raw(p, end, time) || !log_binary::get_raw(p, end, millitm) ||
+            !log_binary::get_raw(p, end, tid) || !log_binary::get_raw(p, end, args_len) ||
+            end - p < static_cast<ptrdiff_t>(args_len)) {
+            p = entry;
+            break;
+        }
+
+        message.clear();
+        log_binary::decode_args(p, args_len, message);
+        p += args_len;
+
+        log_util::Time t;
+        t.time    = static_cast<time_t>(time);
+        t.millitm = millitm;
+        char buf[32];
+
+        line.clear();
+        line.append(buf, log_util::format_time(t, buf));
+        line += ' ';
+        line += severityToString(static_cast<Severity>(severity));
+        line += " [";
+        line += std::to_string(tid);
+        line += "] [";
+        std::unordered_map<uint32_t, Site>::const_iterator it = sites.find(site_id);
+        if (it != sites.end()) {
+            line += it->second.func;
+            line += '@';
+            line += it->second.file;
+            line += '/';
+            line += std::to_string(it->second.line);
+        } else {
+            line += "?site" + std::to_string(site_id);
+        }
+        line += "] ";
+        line += message;
+        line += '\n';
+        fwrite(line.data(), 1, line.size(), out);
+    }
+
+    if (p < end) {
+        //进程崩溃时最后一条可能只写了一半
+        fprintf(stderr, "%s: truncated entry at offset %ld\n", name, static_cast<long>(p - data.data()));
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        return decode(stdin, stdout, "stdin") == 0 ? 0 : 1;
+    }
+
+    int ret = 0;
+    for (int i = 1; i < argc; ++i) {
+        FILE* in = fopen(argv[i], "rb");
+        if (!in) {
+            fprintf(stderr, "open %s failed\n", argv[i]);
+            ret = 1;
+            continue;
+        }
+        if (decode(in, stdout, argv[i]) != 0) {
+            ret = 1;
+        }
+        fclose(in);
+    }
+    return ret;
+}
@@ -31,13 +31,25 @@
 //////////////////////////////////////////////////////////////////////////
 // Log severity level checker
 
-#define IF_LOG_(instance, severity)     if (NS_DLOG::get<instance>() && NS_DLOG::get<instance>()->checkSeverity(severity))
+//编译期的最低日志级别: 0 trace, 1 debug, 2 info, 3 warning, 4 error, 5 fatal, 6 全部去掉.
+//低于它的LOG_*语句条件是常量false, 整条语句(包括参数的计算、get()和checkSeverity)被编译器去掉, -O0也一样
+#ifndef DLOG_MIN_SEVERITY
+#   define DLOG_MIN_SEVERITY 0
+#endif
+
+#define PLOG_SEVERITY_ON(severity)      ((severity) >= DLOG_MIN_SEVERITY)
+
+#define PLOG_CHECK_(instance, severity) (PLOG_SEVERITY_ON(severity) && NS_DLOG::get<instance>() && NS_DLOG::get<instance>()->checkSeverity(severity))
+
+#define IF_LOG_(instance, severity)     if (PLOG_CHECK_(instance, severity))
 #define IF_LOG(severity)                IF_LOG_(PLOG_DEFAULT_INSTANCE, severity)
 
 //////////////////////////////////////////////////////////////////////////
 // Main logging macros
 
-#define LOG_(instance, severity)        IF_LOG_(instance, severity) (*NS_DLOG::get<instance>()) += NS_DLOG::Record(severity, __FILE__, PLOG_GET_FUNC(), __LINE__, PLOG_GET_THIS())
+#define PLOG_RECORD_(instance, severity) (*NS_DLOG::get<instance>()) += NS_DLOG::Record(severity, __FILE__, PLOG_GET_FUNC(), __LINE__, PLOG_GET_THIS())
+
+#define LOG_(instance, severity)        IF_LOG_(instance, severity) PLOG_RECORD_(instance, severity)
 #define LOG(severity)                   LOG_(PLOG_DEFAULT_INSTANCE, severity)
 
 #define LOG_TRACE                       LOG(NS_DLOG::trace)
@@ -102,5 +114,33 @@
 #define LOGE_IF_(instance, condition)           LOG_ERROR_IF_(instance, condition)
 #define LOGF_IF_(instance, condition)           LOG_FATAL_IF_(instance, condition)
 
+//////////////////////////////////////////////////////////////////////////
+// Sampling / rate limiting macros
+// 每个调用点一个计数器(lambda中的static), 先检查级别, 级别没开时不计数
+//   LOG_EVERY_N(NS_DLOG::error, 100) << ...;     //第1, 101, 201...次才写
+//   LOG_RATE_LIMIT(NS_DLOG::error, 10) << ...;   //每秒最多写10条
+
+#define PLOG_CALL_SITE_(type)                   ([]() -> NS_DLOG::type& { static NS_DLOG::type site; return site; }())
+
+#define LOG_EVERY_N_(instance, severity, n)     if (PLOG_CHECK_(instance, severity) && PLOG_CALL_SITE_(Log_Every_N).hit(n)) PLOG_RECORD_(instance, severity)
+#define LOG_EVERY_N(severity, n)                LOG_EVERY_N_(PLOG_DEFAULT_INSTANCE, severity, n)
+
+#define LOG_RATE_LIMIT_(instance, severity, per_sec)    if (PLOG_CHECK_(instance, severity) && PLOG_CALL_SITE_(Log_Rate_Limit).allow(per_sec)) PLOG_RECORD_(instance, severity)
+#define LOG_RATE_LIMIT(severity, per_sec)               LOG_RATE_LIMIT_(PLOG_DEFAULT_INSTANCE, severity, per_sec)
+
+#define LOG_TRACE_EVERY_N(n)                    LOG_EVERY_N(NS_DLOG::trace, n)
+#define LOG_DEBUG_EVERY_N(n)                    LOG_EVERY_N(NS_DLOG::debug, n)
+#define LOG_INFO_EVERY_N(n)                     LOG_EVERY_N(NS_DLOG::info, n)
+#define LOG_WARNING_EVERY_N(n)                  LOG_EVERY_N(NS_DLOG::warning, n)
+#define LOG_ERROR_EVERY_N(n)                    LOG_EVERY_N(NS_DLOG::error, n)
+#define LOG_FATAL_EVERY_N(n)                    LOG_EVERY_N(NS_DLOG::fatal, n)
+
+#define LOG_TRACE_RATE_LIMIT(per_sec)           LOG_RATE_LIMIT(NS_DLOG::trace, per_sec)
+#define LOG_DEBUG_RATE_LIMIT(per_sec)           LOG_RATE_LIMIT(NS_DLOG::debug, per_sec)
+#define LOG_INFO_RATE_LIMIT(per_sec)            LOG_RATE_LIMIT(NS_DLOG::info, per_sec)
+#define LOG_WARNING_RATE_LIMIT(per_sec)         LOG_RATE_LIMIT(NS_DLOG::warning, per_sec)
+#define LOG_ERROR_RATE_LIMIT(per_sec)           LOG_RATE_LIMIT(NS_DLOG::error, per_sec)
+#define LOG_FATAL_RATE_LIMIT(per_sec)           LOG_RATE_LIMIT(NS_DLOG::fatal, per_sec)
+
 #endif
 
@@ -7,15 +7,21 @@
 
 #include "../config.h"
 #include "../pattern.h"
-#include "../thread_pool.h"
+#include "plog_async.h"
+#include "plog_buffer.h"
+#include "plog_binary.h"
 #include <sstream>
 #include <string>
 #include <time.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <sys/stat.h>
 #include <memory>
 #include <utility>
+#include <atomic>
+#include <chrono>
+#include <type_traits>
 
 #ifdef WIN32
 #   include <Windows.h>
@@ -40,6 +46,29 @@
 //是否开启一个独立的线程来写日志?
 #define DLOG_SEPARATE_THREAD 1
 
+//二进制日志: 定义后LOG_*的参数不在调用线程格式化, 只按类型保存原始值(见plog_binary.h),
+//到写线程调用getMessage时才转成文本; 配合Binary_File_Appender连这一步也省了, 用plog_decode离线转换
+//#define DLOG_BINARY_RECORD 1
+
+//轮转出来的日志文件在后台压缩成.gz(见Log_Compressor, appender的set_compress), 需要链接zlib
+//#define DLOG_GZIP 1
+
+//Record内部的消息缓冲区大小, 消息(二进制日志为编码后的参数)不超过这么长时不分配内存
+#ifndef DLOG_RECORD_INLINE_SIZE
+#   define DLOG_RECORD_INLINE_SIZE 184
+#endif
+
+//Record的字段(NS_DLOG::field)缓冲区大小, 编码后(类型+key+值)不超过这么长时不分配内存
+#ifndef DLOG_RECORD_FIELDS_SIZE
+#   define DLOG_RECORD_FIELDS_SIZE 64
+#endif
+
+//独立线程的队列能容纳多少条日志, 满了按Logger::set_overflow_policy处理.
+//每条占sizeof(Record)(默认336字节), 队列在创建时一次分配好
+#ifndef DLOG_ASYNC_CAPACITY
+#   define DLOG_ASYNC_CAPACITY 8192
+#endif
+
 DLOG_NAMESPACE_BEGIN
 
 //////////////////      log_util        /////////////////////////////////////////
@@ -98,6 +127,47 @@ namespace log_util {
 #endif
     }
 
+    //把t格式化成"2016-01-02 03:04:05.678"写到buf(至少24字节), 返回长度(不含'\0').
+    //每个线程缓存到秒的部分, 换秒时才调用localtime/strftime, 毫秒直接填进去
+    inline size_t format_time(const Time& t, char* buf)
+    {
+        struct Cache {
+            time_t  sec;
+            size_t  len;
+            char    text[24];
+        };
+        static thread_local Cache cache = { static_cast<time_t>(-1), 0, { 0 } };
+
+        if (cache.sec != t.time || cache.len == 0) {
+            tm lt;
+            localtime_s(&lt, &t.time);
+            cache.len = strftime(cache.text, sizeof(cache.text), "%Y-%m-%d %H:%M:%S", &lt);
+            cache.sec = t.time;
+        }
+
+        unsigned int ms = t.millitm % 1000;
+        memcpy(buf, cache.text, cache.len);
+        char* p = buf + cache.len;
+        p[0] = '.';
+        p[1] = static_cast<char>('0' + ms / 100);
+        p[2] = static_cast<char>('0' + ms / 10 % 10);
+        p[3] = static_cast<char>('0' + ms % 10);
+        return cache.len + 4;
+    }
+
+    //now之后的下一个本地时间0点
+    inline time_t next_day(time_t now)
+    {
+        tm t;
+        localtime_s(&t, &now);
+        t.tm_hour  = 0;
+        t.tm_min   = 0;
+        t.tm_sec   = 0;
+        t.tm_mday += 1;
+        t.tm_isdst = -1;
+        return mktime(&t);
+    }
+
     inline std::stringstream& operator<<(std::stringstream& stream, const char* data)
     {
         std::operator<< (stream, (data ? data : "(null)"));
@@ -128,6 +198,38 @@ namespace log_util {
         int rc = stat(filename.c_str(), &stat_buf);
         return rc == 0 ? stat_buf.st_size : -1;
     }
+
+    //__PRETTY_FUNCTION__的格式：int Cls::foo(int, double), 这里仅取出Cls::foo, 追加到out
+    inline void append_short_func_name(const char* func, std::string& out)
+    {
+#if (defined(WIN32) && !defined(__MINGW32__)) || defined(__OBJC__)
+        out += func;
+#else
+        const char* funcBegin = func;
+        const char* funcEnd   = ::strchr(funcBegin, '(');
+
+        if (!funcEnd) {
+            out += func;
+            return;
+        }
+
+        for (const char* i = funcEnd - 1; i >= funcBegin; --i) { // search backwards for the first space char
+            if (*i == ' ') {
+                funcBegin = i + 1;
+                break;
+            }
+        }
+
+        out.append(funcBegin, funcEnd);
+#endif
+    }
+
+    inline std::string short_func_name(const char* func)
+    {
+        std::string name;
+        append_short_func_name(func, name);
+        return name;
+    }
 }
 
 /////////////////////// Severity   ///////////////////////////////////
@@ -173,8 +275,42 @@ inline Severity severityFromString(const char* str)
 }    
 
 ////////////////////////    Record      ///////////////////////////////////////
+//带类型的字段, JsonFormatter/LogfmtFormatter输出为单独的key, TxtFormatter输出在消息后面(key=value)
+//  LOG_INFO << "login" << NS_DLOG::field("user", name) << NS_DLOG::field("cost_ms", 1.25);
+//key一般是字符串常量, 值的类型同operator<<.
+//数值、枚举和指针(包括字符串常量)按值保存; std::string等其它类型保存的是引用,
+//field()的返回值只能在同一条日志语句中使用, 不要保存下来以后再输出
+template<typename T>
+struct Log_Field_Value
+{
+    typedef typename std::decay<const T>::type Decayed;
+    typedef typename std::conditional<std::is_arithmetic<Decayed>::value || std::is_enum<Decayed>::value ||
+                                      std::is_pointer<Decayed>::value,
+                                      Decayed, const T&>::type type;
+};
+
+template<typename T>
+struct Log_Field
+{
+    const char* key;
+    typename Log_Field_Value<T>::type value;
+};
+
+template<typename T>
+inline Log_Field<T> field(const char* key, const T& value)
+{
+    Log_Field<T> f = { key, value };
+    return f;
+}
+
+//数据都放在对象内部, 消息写在固定大小的缓冲区中(超长时才分配内存), 移动到异步队列只是一次内存复制
 class Record
 {
+public:
+    typedef Log_Buffer<DLOG_RECORD_INLINE_SIZE> Buffer;
+    typedef Log_Buffer<DLOG_RECORD_FIELDS_SIZE> Field_Buffer;
+
+private:
     struct Record_Data {
         log_util::Time      m_time;
         const Severity      m_severity;
@@ -183,7 +319,8 @@ class Record
         const char* const   m_file_name;
         const size_t        m_line;
         const char* const   m_func;
-        std::stringstream   m_message;
+        Buffer              m_message;  //文本, 二进制日志为编码后的参数(见log_binary::Arg_Writer)
+        Field_Buffer        m_fields;   //编码后的字段, 见log_binary::Field_Reader
 
         inline Record_Data(Severity severity, const char* file_name, const char* func, size_t line, const void* object)
             : m_severity(severity), m_tid(log_util::get_thread_id()), m_object(object)
@@ -191,109 +328,176 @@ class Record
         {
             log_util::ftime(&m_time);
         }
-    };
-
-    inline Record(Record_Data *d)
-        : data_(d)
-    {}
 
-    template<int>
-    friend class Logger;
+        Record_Data(Record_Data&& d) noexcept
+            : m_time(d.m_time), m_severity(d.m_severity), m_tid(d.m_tid), m_object(d.m_object)
+            , m_file_name(d.m_file_name), m_line(d.m_line), m_func(d.m_func)
+            , m_message(std::move(d.m_message))
+            , m_fields(std::move(d.m_fields))
+        {}
+    };
 
 public:
     inline Record(Severity severity, const char* file_name, const char* func, size_t line, const void* object)
-        : data_(new Record_Data(severity, file_name, func, line, object))
+        : data_(severity, file_name, func, line, object)
     {}
 
-    ~Record() {
-        if (data_) {
-            delete data_;
-        }
-    }
-
     inline Record(Record && r) noexcept
-           :data_(r.data_)
+           :data_(std::move(r.data_))
     {
-        r.data_ = nullptr;
     }
 
     Record& operator<<(char data)
     {
-        char str[] = { data, 0 };
-        *this << str;
+#ifdef DLOG_BINARY_RECORD
+        log_binary::Arg_Writer<Buffer>(data_.m_message).put(data);
+#else
+        Text_Writer<Buffer>(data_.m_message).put(data);
+#endif
+        return *this;
+    }
+
+    template<typename T>
+    Record& operator<<(const Log_Field<T>& f)
+    {
+        log_binary::Arg_Writer<Field_Buffer> w(data_.m_fields);
+        w.put_string(f.key, strlen(f.key));
+        put_field_value(w, f.value);
         return *this;
     }
 
+#ifdef DLOG_BINARY_RECORD
+    template<typename T>
+    Record& operator<<(const T& data)
+    {
+        log_binary::Arg_Writer<Buffer>(data_.m_message).put(data);
+        return *this;
+    }
+#else
     template<typename T>
     Record& operator<<(const T& data)
     {
-        using namespace log_util;
-        data_->m_message << data;
+        Text_Writer<Buffer>(data_.m_message).put(data);
         return *this;
     }
+#endif
 
     const log_util::Time& getTime() const
     {
-        return data_->m_time;
+        return data_.m_time;
     }
 
     Severity getSeverity() const
     {
-        return data_->m_severity;
+        return data_.m_severity;
     }
 
     unsigned int getTid() const
     {
-        return data_->m_tid;
+        return data_.m_tid;
     }
 
     const void* getObject() const
     {
-        return data_->m_object;
+        return data_.m_object;
     }
 
     const char* getFileName() const
     {
-        return data_->m_file_name;
+        return data_.m_file_name;
     }
 
     size_t getLine() const
     {
-        return data_->m_line;
+        return data_.m_line;
     }
 
+#ifdef DLOG_BINARY_RECORD
     const std::string getMessage() const
     {
-        return data_->m_message.str();
+        std::string message;
+        log_binary::decode_args(data_.m_message.data(), data_.m_message.size(), message);
+        return message;
     }
 
-    std::string getFunc() const
+    void appendMessage(std::string& out) const
     {
-        const char* func = data_->m_func;
-#if (defined(WIN32) && !defined(__MINGW32__)) || defined(__OBJC__)
-        return std::string(func);
+        log_binary::decode_args(data_.m_message.data(), data_.m_message.size(), out);
+    }
+
+    //消息的文本, 长度放在size. 二进制日志要先解码, 放在scratch中
+    const char* getMessageText(std::string& scratch, size_t& size) const
+    {
+        scratch.clear();
+        appendMessage(scratch);
+        size = scratch.size();
+        return scratch.data();
+    }
+
+    //参数编码后的内容, 给Binary_File_Appender用
+    void getArgs(std::string& out) const
+    {
+        out.append(data_.m_message.data(), data_.m_message.size());
+    }
 #else
-        //函数格式：int Cls::foo(int, double), 这里仅取出Cls::foo
-        const char* funcBegin = func;
-        const char* funcEnd   = ::strchr(funcBegin, '(');
+    const std::string getMessage() const
+    {
+        return std::string(data_.m_message.data(), data_.m_message.size());
+    }
 
-        if (!funcEnd) {
-            return std::string(func);
-        }
+    void appendMessage(std::string& out) const
+    {
+        out.append(data_.m_message.data(), data_.m_message.size());
+    }
 
-        for (const char* i = funcEnd - 1; i >= funcBegin; --i) { // search backwards for the first space char
-            if (*i == ' ') {
-                funcBegin = i + 1;
-                break;
-            }
-        }
+    const char* getMessageText(std::string&, size_t& size) const
+    {
+        size = data_.m_message.size();
+        return data_.m_message.data();
+    }
 
-        return std::string(funcBegin, funcEnd);
+    void getArgs(std::string& out) const
+    {
+        log_binary::Arg_Writer<std::string>(out).put_string(data_.m_message.data(), data_.m_message.size());
+    }
 #endif
+
+    std::string getFunc() const
+    {
+        return log_util::short_func_name(data_.m_func);
+    }
+
+    //未经处理的函数名(__PRETTY_FUNCTION__), 同一调用点的指针不变
+    const char* getRawFunc() const
+    {
+        return data_.m_func;
+    }
+
+    bool hasFields() const
+    {
+        return !data_.m_fields.empty();
+    }
+
+    log_binary::Field_Reader getFields() const
+    {
+        return log_binary::Field_Reader(data_.m_fields.data(), data_.m_fields.size());
+    }
+
+private:
+    //字段的值: 字符串原样保存(空串也是空串), 其余同operator<<
+    template<typename T>
+    static void put_field_value(log_binary::Arg_Writer<Field_Buffer>& w, const T& value)
+    {
+        w.put(value);
+    }
+
+    static void put_field_value(log_binary::Arg_Writer<Field_Buffer>& w, const std::string& value)
+    {
+        w.put_string(value.data(), value.size());
     }
 
 private:
-    Record_Data *data_;
+    Record_Data data_;
 };  
 
 //////////////////       Formatter      ////////////////////////////////////
@@ -307,22 +511,165 @@ public:
 
     static std::string format(const Record& record)
     {
-        tm t;
-        log_util::localtime_s(&t, &record.getTime().time);
+        std::string out;
+        format_to(record, out);
+        return out;
+    }
+
+    //追加到out. appender用一个成员做缓冲区反复使用, 不必每条日志都分配内存
+    static void format_to(const Record& record, std::string& out)
+    {
+        char buf[32];
+        out.append(buf, log_util::format_time(record.getTime(), buf));
+        out += ' ';
+        out += severityToString(record.getSeverity());
+        out.append(" [", 2);
+        out.append(buf, log_format::format_uint(buf, record.getTid()));
+        out.append("] [", 3);
+        log_util::append_short_func_name(record.getRawFunc(), out);
+        out += '@';
+        out += record.getFileName();
+        out += '/';
+        out.append(buf, log_format::format_uint(buf, record.getLine()));
+        out.append("] ", 2);
+        record.appendMessage(out);
+        append_fields(record, out);
+        out += '\n';
+    }
+
+    //字段接在消息后面: " key=value"
+    static void append_fields(const Record& record, std::string& out)
+    {
+        if (!record.hasFields()) {
+            return;
+        }
+        log_binary::Field_Reader fields = record.getFields();
+        log_binary::Arg_Value key, value;
+        while (fields.next(key, value)) {
+            out += ' ';
+            out.append(key.str, key.len);
+            out += '=';
+            log_binary::append_arg_logfmt(value, out);
+        }
+    }
+};
 
-        char buf[64];
-        int n = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &t);
-        sprintf(buf + n, ".%.3hu", record.getTime().millitm);
-        
-        std::stringstream ss;
-        ss << buf << " " << severityToString(record.getSeverity()) << " ";
-        //ss << std::setfill(PLOG_NSTR(' ')) << std::setw(5) << std::left <<  << " ";
+//每条日志一行JSON, 字段按类型输出:
+//{"time":"2016-01-02T03:04:05.678","level":"INFO","tid":123,"func":"Cls::foo","file":"a.cpp","line":10,"msg":"...","user":"bob","cost_ms":1.25}
+class JsonFormatter
+{
+public:
+    static std::string header()
+    {
+        return std::string();
+    }
+
+    static std::string format(const Record& record)
+    {
+        std::string out;
+        format_to(record, out);
+        return out;
+    }
+
+    static void format_to(const Record& record, std::string& out)
+    {
+        char buf[32];
+        size_t n = log_util::format_time(record.getTime(), buf);
+        buf[10] = 'T';      //ISO 8601
+        out.append("{\"time\":\"", 9);
+        out.append(buf, n);
+        out.append("\",\"level\":\"", 11);
+        out += severityToString(record.getSeverity());
+        out.append("\",\"tid\":", 8);
+        out.append(buf, log_format::format_uint(buf, record.getTid()));
+        out.append(",\"func\":\"", 9);
+        size_t func = out.size();
+        log_util::append_short_func_name(record.getRawFunc(), out);
+        escape_tail(out, func);
+        out.append("\",\"file\":\"", 10);
+        log_format::append_json_escaped(out, record.getFileName(), strlen(record.getFileName()));
+        out.append("\",\"line\":", 9);
+        out.append(buf, log_format::format_uint(buf, record.getLine()));
+        out.append(",\"msg\":\"", 8);
+
+        static thread_local std::string scratch;
+        size_t len;
+        const char* msg = record.getMessageText(scratch, len);
+        log_format::append_json_escaped(out, msg, len);
+        out += '"';
+
+        log_binary::Field_Reader fields = record.getFields();
+        log_binary::Arg_Value key, value;
+        while (fields.next(key, value)) {
+            out.append(",\"", 2);
+            log_format::append_json_escaped(out, key.str, key.len);
+            out.append("\":", 2);
+            log_binary::append_arg_json(value, out);
+        }
+        out.append("}\n", 2);
+    }
+
+private:
+    //out中从pos开始的部分原地转义. 函数名一般不需要转义, 只在有特殊字符时才复制
+    static void escape_tail(std::string& out, size_t pos)
+    {
+        for (size_t i = pos; i < out.size(); ++i) {
+            unsigned char c = static_cast<unsigned char>(out[i]);
+            if (c < 0x20 || c == '"' || c == '\\') {
+                std::string raw = out.substr(pos);
+                out.resize(pos);
+                log_format::append_json_escaped(out, raw.data(), raw.size());
+                return;
+            }
+        }
+    }
+};
+
+//每条日志一行logfmt:
+//time=2016-01-02T03:04:05.678 level=INFO tid=123 func=Cls::foo file=a.cpp line=10 msg="..." user=bob cost_ms=1.25
+class LogfmtFormatter
+{
+public:
+    static std::string header()
+    {
+        return std::string();
+    }
 
-        ss << "[" << record.getTid() << "] ";
-        ss << "[" << record.getFunc().c_str() << "@" << record.getFileName() << "/" << record.getLine() << "] ";
-        ss << record.getMessage().c_str() << "\n";
+    static std::string format(const Record& record)
+    {
+        std::string out;
+        format_to(record, out);
+        return out;
+    }
 
-        return ss.str();
+    static void format_to(const Record& record, std::string& out)
+    {
+        char buf[32];
+        size_t n = log_util::format_time(record.getTime(), buf);
+        buf[10] = 'T';
+        out.append("time=", 5);
+        out.append(buf, n);
+        out.append(" level=", 7);
+        out += severityToString(record.getSeverity());
+        out.append(" tid=", 5);
+        out.append(buf, log_format::format_uint(buf, record.getTid()));
+        out.append(" func=", 6);
+        static thread_local std::string scratch;
+        scratch.clear();
+        log_util::append_short_func_name(record.getRawFunc(), scratch);
+        log_format::append_logfmt_value(out, scratch.data(), scratch.size());
+        out.append(" file=", 6);
+        log_format::append_logfmt_value(out, record.getFileName(), strlen(record.getFileName()));
+        out.append(" line=", 6);
+        out.append(buf, log_format::format_uint(buf, record.getLine()));
+        out.append(" msg=", 5);
+
+        size_t len;
+        const char* msg = record.getMessageText(scratch, len);
+        log_format::append_logfmt_value(out, msg, len);
+
+        TxtFormatter::append_fields(record, out);
+        out += '\n';
     }
 };
 
@@ -332,6 +679,17 @@ class IAppender
 public:
     virtual ~IAppender() {}
     virtual void write(const Record& record) = 0;
+
+    //一次写多条, 独立线程模式下由写线程调用. 默认逐条write, 能合并写的appender可以重写
+    virtual void write_batch(const Record* const* records, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i) {
+            write(*records[i]);
+        }
+    }
+
+    //把缓存的内容写到文件, Logger::flush时调用
+    virtual void flush() {}
 };
 
 
@@ -343,7 +701,9 @@ public:
     Logger(Severity minSeverity = debug) 
         : m_minSeverity(minSeverity)
 #ifdef DLOG_SEPARATE_THREAD
-        , pool_(1, false)
+        , async_(DLOG_ASYNC_CAPACITY,
+                 [this](Record* const* records, size_t count) { this->log_batch_to_appender(records, count); },
+                 [this]() { this->flush_appender(); })
 #endif
     {
     }
@@ -379,20 +739,32 @@ public:
 #else
     void operator+=(Record& record)
     {
-        //auto f = [this](Record::Record_Data* p){
-        //    this->log_to_appender(Record(p));
-        //};
-        //auto ptr = record.data_;
-        //record.data_ = nullptr;
-        //pool_.enqueue(f, ptr);
+        async_.push(record);
+    }
 
-        auto f = [this](const Record& r){
-            this->log_to_appender(r);
-        };
-        pool_.enqueue(f, std::move(record));
+    //队列满时阻塞(默认)还是丢弃
+    void set_overflow_policy(Async_Overflow_Policy policy)
+    {
+        async_.set_overflow_policy(policy);
+    }
+
+    //队列满被丢弃的日志条数
+    uint64_t dropped() const
+    {
+        return async_.dropped();
     }
 #endif
 
+    //等待之前的日志都已写出, 并flush各appender. 如程序退出前、abort前调用
+    void flush()
+    {
+#ifdef DLOG_SEPARATE_THREAD
+        async_.flush();
+#else
+        flush_appender();
+#endif
+    }
+
     inline void log_to_appender(const Record& record)
     {
         //std::vector<std::shared_ptr<IAppender>>::iterator
@@ -401,14 +773,67 @@ public:
         }
     }
 
+    inline void log_batch_to_appender(const Record* const* records, size_t count)
+    {
+        for (auto it = m_appenders.begin(); it != m_appenders.end(); ++it) {
+            (*it)->write_batch(records, count);
+        }
+    }
+
+    inline void flush_appender()
+    {
+        for (auto it = m_appenders.begin(); it != m_appenders.end(); ++it) {
+            (*it)->flush();
+        }
+    }
+
 private:
     Severity m_minSeverity;
     std::vector<std::shared_ptr<IAppender> > m_appenders;
 #ifdef DLOG_SEPARATE_THREAD
-    Thread_Pool pool_;
+    Async_Ring<Record> async_;      //在m_appenders之后构造, 析构时先写完剩余的日志
 #endif
 };
 
+//////////////////    调用点的采样/限速, 见LOG_EVERY_N, LOG_RATE_LIMIT  ////////////
+//每n次返回一次true(第1次为true)
+class Log_Every_N
+{
+public:
+    Log_Every_N() : count_(0) {}
+
+    bool hit(unsigned int n)
+    {
+        unsigned int c = count_.fetch_add(1, std::memory_order_relaxed);
+        return n <= 1 || c % n == 0;
+    }
+
+private:
+    std::atomic<unsigned int> count_;
+};
+
+//每秒最多per_sec次返回true. 按秒分窗口计数, 窗口只往前换; 多线程换窗口时可能多放过几条
+class Log_Rate_Limit
+{
+public:
+    Log_Rate_Limit() : second_(-1), count_(0) {}
+
+    bool allow(unsigned int per_sec)
+    {
+        int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        int64_t second = second_.load(std::memory_order_relaxed);
+        if (second < now && second_.compare_exchange_strong(second, now, std::memory_order_relaxed)) {
+            count_.store(0, std::memory_order_relaxed);
+        }
+        return count_.fetch_add(1, std::memory_order_relaxed) < per_sec;
+    }
+
+private:
+    std::atomic<int64_t>      second_;
+    std::atomic<unsigned int> count_;
+};
+
 template<int instance>
 inline Logger<instance>* get()
 {
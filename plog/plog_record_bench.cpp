@@ -0,0 +1,85 @@
+//写日志线程一侧的开销: LOG_INFO构造Record并提交到队列的耗时和内存分配次数, appender什么都不做
+//编译: g++ -std=c++11 -O2 -pthread plog_record_bench.cpp -o plog_record_bench
+//      加 -DDLOG_BINARY_RECORD 测二进制记录
+//用法: plog_record_bench [次数]
+
+#include "plog_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <new>
+
+using namespace NS_DLOG;
+
+//delete不内联: 否则gcc在调用处看到free配对operator new, 报-Wmismatched-new-delete
+#ifdef __GNUC__
+#   define BENCH_NOINLINE __attribute__((noinline))
+#else
+#   define BENCH_NOINLINE
+#endif
+
+//只统计写日志的线程在计时期间的分配
+static thread_local bool g_counting = false;
+static thread_local long g_allocs   = 0;
+
+void* operator new(size_t n)
+{
+    if (g_counting) {
+        ++g_allocs;
+    }
+    void* p = malloc(n ? n : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+BENCH_NOINLINE void operator delete(void* p) noexcept {
+    free(p);
+}
+
+BENCH_NOINLINE void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+class Null_Appender : public IAppender
+{
+public:
+    Null_Appender() : lines_(0) {}
+
+    virtual void write(const Record& record) {
+        lines_ += record.getLine() != 0;
+    }
+
+private:
+    size_t lines_;
+};
+
+int main(int argc, char** argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 1000000;
+    Logger<PLOG_DEFAULT_INSTANCE>& logger = init(debug, std::make_shared<Null_Appender>());
+
+    double best  = 1e30;
+    long allocs = 0;
+    for (int round = 0; round < 3; ++round) {
+        g_allocs   = 0;
+        g_counting = true;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; ++i) {
+            LOG_INFO << "request " << i << " took " << 1.25 * i << " ms, user=" << "alice";
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        g_counting = false;
+        allocs = g_allocs;
+        logger.flush();
+
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / count;
+        if (ns < best) {
+            best = ns;
+        }
+    }
+
+    printf("sizeof(Record)=%zu  %.0f ns/LOG  %.2f allocs/LOG\n", sizeof(Record), best, double(allocs) / count);
+    return 0;
+}
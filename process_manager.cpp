@@ -76,16 +76,18 @@ Process_Manager::~Process_Manager()
     thread_group_.join_all();
 }
 
+//回调在解锁后执行: 回调中可能再启动子进程(insert_hash要加锁)
 void Process_Manager::do_callback(pid_t pid, int status)
 {
     std::unique_lock<std::mutex> lock(mutex_);
     Hahs_Iterator it = hash_.find(pid);
     if (it != hash_.end()) {
         Child_Exit_Callback fn = it->second;
+        hash_.erase(it);
+        lock.unlock();
         if (fn) {
             fn(pid, status);    //回调函数
         }
-        hash_.erase(it);
     } 
 #if 0
     else {
@@ -128,6 +130,11 @@ int Process_Manager::start(const string& work_dir, const string& cmd,
         ::system(s.c_str());
     }
 
+    return spawn(work_dir, cmd, fn);
+}
+
+int Process_Manager::spawn(const string& work_dir, const string& cmd, Child_Exit_Callback fn)
+{
     pid_t pid = fork();
     if (pid == -1) {
         errorlog() << "fork error";
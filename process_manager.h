@@ -35,6 +35,9 @@ public:
     //成功返回pid, 失败返回<0
     int start(const string& work_dir, const string& cmd, /*const string& arg, */Child_Exit_Callback fn, bool kill_old = true);
 
+    //只启动子进程: 不杀同名进程, 也不附加到已有的进程. 成功返回pid, 失败返回<0
+    int spawn(const string& work_dir, const string& cmd, Child_Exit_Callback fn);
+
     //附加到一个命令行, 成功返回进程id，失败返回-1
     int attach(const string& cmd, Child_Exit_Callback fn);
 
@@ -0,0 +1,154 @@
+#ifndef _SHARDED_TIMER_WHEEL_H_
+#define _SHARDED_TIMER_WHEEL_H_
+
+//按线程分片的时间轮: 每个分片一个时间轮, 定时器放在调用schedule的线程对应的分片上,
+//各分片由各自的线程驱动, 互不竞争. 句柄中记录了分片号, cancel_timer可以在任意线程调用, 自动转到对应分片.
+//  句柄: 高32位为代数, 低32位中高SHARD_BITS位为分片号, 其余为分片内的节点下标(见Concurrent_Timer_wheel)
+//两种用法:
+//  1. 和Thread_Pool配合, 每个worker一个分片, 定时器回调在该分片对应的worker上执行:
+//      Sharded_Timer_wheel timers(pool);
+//      pool.post([&] { timers.schedule(&tv, 0, on_timeout, conn); });  //在当前worker的分片上
+//      timers.dispatch();      //由一个驱动线程循环调用(如每毫秒一次), 把到期处理投递到各分片的worker
+//  2. 独立使用, 分片数自定, 每个分片由使用者的某个线程调用expire(shard, tv)
+//注意:
+//  线程池模式下, 析构前要先停止线程池(或确认dispatch投递的任务都已执行完)
+
+#include "concurrent_timer_wheel.h"
+#include "thread_pool.h"
+
+class Sharded_Timer_wheel
+{
+public:
+    typedef uint64_t Timer_id;
+
+    enum {
+        SHARD_BITS = 32 - Concurrent_Timer_wheel::INDEX_BITS,
+        MAX_SHARDS = 1 << SHARD_BITS,
+    };
+
+    //独立使用, 共shards个分片
+    explicit Sharded_Timer_wheel(size_t shards)
+        : pool_(nullptr)
+    {
+        init(shards);
+    }
+
+    //每个worker一个分片(按max_threads, 弹性线程池也一样)
+    explicit Sharded_Timer_wheel(Thread_Pool& pool)
+        : pool_(&pool)
+    {
+        init(pool.max_threads());
+    }
+
+    size_t shard_count() const {
+        return shard_count_;
+    }
+
+    //当前线程对应的分片: 线程池的worker为自己的分片, 其它线程按首次使用的顺序轮流分配
+    size_t current_shard() const
+    {
+        if (pool_) {
+            size_t index = pool_->current_worker_index();
+            if (index != static_cast<size_t>(Thread_Pool::NOT_WORKER)) {
+                return index % shard_count_;
+            }
+        }
+        return thread_slot() % shard_count_;
+    }
+
+    //在当前线程的分片上新增一个定时器, 返回0为失败
+    template<typename F, typename ...Args>
+    Timer_id schedule(const timeval* expire_tv, unsigned long interval, F&& f, Args&& ...args)
+    {
+        return schedule_on(current_shard(), expire_tv, interval, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    //在指定分片上新增一个定时器
+    template<typename F, typename ...Args>
+    Timer_id schedule_on(size_t shard, const timeval* expire_tv, unsigned long interval, F&& f, Args&& ...args)
+    {
+        shard %= shard_count_;
+        Timer_id id = shards_[shard].schedule(expire_tv, interval, std::forward<F>(f), std::forward<Args>(args)...);
+        if (id == 0) {
+            return 0;
+        }
+        return id | (static_cast<Timer_id>(shard) << Concurrent_Timer_wheel::INDEX_BITS);
+    }
+
+    //取消定时器, 任意线程可调用. 0-成功, 其它值-失败
+    int cancel_timer(Timer_id id)
+    {
+        size_t shard = static_cast<uint32_t>(id) >> Concurrent_Timer_wheel::INDEX_BITS;
+        if (shard >= shard_count_) {
+            return -1;
+        }
+        Timer_id mask = static_cast<Timer_id>(MAX_SHARDS - 1) << Concurrent_Timer_wheel::INDEX_BITS;
+        return shards_[shard].cancel_timer(id & ~mask);
+    }
+
+    //触发某个分片中过期的定时器. 同一分片同一时刻只能有一个线程调用
+    int expire(size_t shard, const timeval* tv) {
+        return shards_[shard].expire(tv);
+    }
+
+    long next_timeout(size_t shard, const timeval* tv) {
+        return shards_[shard].next_timeout(tv);
+    }
+
+    //线程池模式: 把各分片的expire投递到对应的worker上执行, 回调因此在该worker上运行.
+    //上一次投递的还没执行完的分片跳过. 返回本次投递的分片数, 独立使用时返回0
+    int dispatch()
+    {
+        if (!pool_) {
+            return 0;
+        }
+
+        int posted = 0;
+        for (size_t i = 0; i < shard_count_; ++i) {
+            if (posted_[i].exchange(true)) {
+                continue;
+            }
+            bool ok = pool_->post_to_worker(i, [this, i]() {
+                timeval now;
+                gettimeofday(&now, NULL);
+                this->shards_[i].expire(&now);
+                this->posted_[i] = false;
+            });
+            if (ok) {
+                ++posted;
+            } else {
+                posted_[i] = false;     //线程池已停止
+            }
+        }
+        return posted;
+    }
+
+private:
+    void init(size_t shards)
+    {
+        shard_count_ = shards == 0 ? 1 : (shards > static_cast<size_t>(MAX_SHARDS) ? static_cast<size_t>(MAX_SHARDS) : shards);
+        shards_.reset(new Concurrent_Timer_wheel[shard_count_]);
+        posted_.reset(new std::atomic<bool>[shard_count_]);
+        for (size_t i = 0; i < shard_count_; ++i) {
+            posted_[i] = false;
+        }
+    }
+
+    static size_t thread_slot()
+    {
+        static std::atomic<size_t> next(0);
+        static thread_local size_t slot = next++;
+        return slot;
+    }
+
+    Sharded_Timer_wheel(const Sharded_Timer_wheel&);
+    Sharded_Timer_wheel& operator=(const Sharded_Timer_wheel&);
+
+private:
+    Thread_Pool*                                  pool_;
+    size_t                                        shard_count_;
+    std::unique_ptr<Concurrent_Timer_wheel[]>     shards_;
+    std::unique_ptr< std::atomic<bool>[] >        posted_;    //dispatch投递了还未执行
+};
+
+#endif
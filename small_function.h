@@ -0,0 +1,166 @@
+#ifndef _SMALL_FUNCTION_H_
+#define _SMALL_FUNCTION_H_
+
+//只能移动(move-only)的函数包装, 类似std::function, 但:
+//  1. 不要求可调用对象可拷贝, 可以装 std::packaged_task、捕获unique_ptr的lambda等
+//  2. 可调用对象不超过 Inline_Size 字节时直接存放在对象内部, 不分配堆内存;
+//     超过时才退化为new一个出来
+//用法:
+//  Small_Function<void()> fn = [p = std::move(ptr)]() { ... };
+//  fn();
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+template<typename Signature, size_t Inline_Size = 48>
+class Small_Function;
+
+template<typename R, typename... Args, size_t Inline_Size>
+class Small_Function<R(Args...), Inline_Size>
+{
+    typedef typename std::aligned_storage<Inline_Size, alignof(std::max_align_t)>::type Storage;
+
+    //每种可调用对象类型对应一张静态操作表, 代替虚函数
+    struct Ops {
+        R    (*invoke)(void* p, Args&&... args);
+        void (*move)(void* dst, void* src);     //把src移动到dst, 并析构src
+        void (*destroy)(void* p);
+    };
+
+    //存放在内部缓冲区
+    template<typename F>
+    struct Inline_Ops {
+        static R invoke(void* p, Args&&... args) {
+            return (*static_cast<F*>(p))(std::forward<Args>(args)...);
+        }
+        static void move(void* dst, void* src) {
+            ::new (dst) F(std::move(*static_cast<F*>(src)));
+            static_cast<F*>(src)->~F();
+        }
+        static void destroy(void* p) {
+            static_cast<F*>(p)->~F();
+        }
+        static const Ops* ops() {
+            static const Ops o = { &invoke, &move, &destroy };
+            return &o;
+        }
+    };
+
+    //太大的对象放在堆上, 内部缓冲区只存指针
+    template<typename F>
+    struct Heap_Ops {
+        static R invoke(void* p, Args&&... args) {
+            return (**static_cast<F**>(p))(std::forward<Args>(args)...);
+        }
+        static void move(void* dst, void* src) {
+            *static_cast<F**>(dst) = *static_cast<F**>(src);
+        }
+        static void destroy(void* p) {
+            delete *static_cast<F**>(p);
+        }
+        static const Ops* ops() {
+            static const Ops o = { &invoke, &move, &destroy };
+            return &o;
+        }
+    };
+
+    template<typename F>
+    struct Fits_Inline {
+        static const bool value = sizeof(F) <= sizeof(Storage)
+                               && alignof(F) <= alignof(Storage)
+                               && std::is_nothrow_move_constructible<F>::value;
+    };
+
+public:
+    Small_Function() : ops_(nullptr) {}
+    Small_Function(std::nullptr_t) : ops_(nullptr) {}
+
+    template<typename F, typename = typename std::enable_if<
+                 !std::is_same<typename std::decay<F>::type, Small_Function>::value>::type>
+    Small_Function(F&& f) : ops_(nullptr)
+    {
+        typedef typename std::decay<F>::type Fn;
+        construct<Fn>(std::forward<F>(f), std::integral_constant<bool, Fits_Inline<Fn>::value>());
+    }
+
+    Small_Function(Small_Function&& other) noexcept : ops_(other.ops_)
+    {
+        if (ops_) {
+            ops_->move(&storage_, &other.storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    Small_Function& operator=(Small_Function&& other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            if (other.ops_) {
+                other.ops_->move(&storage_, &other.storage_);
+                ops_ = other.ops_;
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    Small_Function& operator=(std::nullptr_t)
+    {
+        reset();
+        return *this;
+    }
+
+    ~Small_Function()
+    {
+        reset();
+    }
+
+    explicit operator bool() const {
+        return ops_ != nullptr;
+    }
+
+    R operator()(Args... args)
+    {
+        return ops_->invoke(&storage_, std::forward<Args>(args)...);
+    }
+
+    void reset()
+    {
+        if (ops_) {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    //可调用对象类型F能否存放在内部缓冲区(不分配内存)
+    template<typename F>
+    static bool is_inline() {
+        return Fits_Inline<typename std::decay<F>::type>::value;
+    }
+
+private:
+    Small_Function(const Small_Function&);
+    Small_Function& operator=(const Small_Function&);
+
+    template<typename Fn, typename F>
+    void construct(F&& f, std::true_type)
+    {
+        ::new (static_cast<void*>(&storage_)) Fn(std::forward<F>(f));
+        ops_ = Inline_Ops<Fn>::ops();
+    }
+
+    template<typename Fn, typename F>
+    void construct(F&& f, std::false_type)
+    {
+        *reinterpret_cast<Fn**>(&storage_) = new Fn(std::forward<F>(f));
+        ops_ = Heap_Ops<Fn>::ops();
+    }
+
+private:
+    Storage    storage_;
+    const Ops* ops_;
+};
+
+#endif
@@ -16,63 +16,463 @@
 #include <future>
 #include <functional>
 #include <stdexcept>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <algorithm>
+#include "small_function.h"
+#include "latency_histogram.h"
+
+#ifdef __linux__
+#   include <pthread.h>
+#   include <sched.h>
+#endif
+
+//环形缓冲区实现的双端队列, 容量只增不减. 
+//std::queue/std::deque在队头前移时会不断释放、申请内存块, 这个在稳定状态下不分配内存
+template<typename T>
+class Ring_Deque {
+public:
+    Ring_Deque() : head_(0), size_(0) {}
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+
+    T& front() { return buf_[head_]; }
+    T& back()  { return buf_[(head_ + size_ - 1) & (buf_.size() - 1)]; }
+
+    void push_back(T&& v)
+    {
+        if (size_ == buf_.size()) {
+            grow();
+        }
+        buf_[(head_ + size_) & (buf_.size() - 1)] = std::move(v);
+        ++size_;
+    }
+
+    void pop_front()
+    {
+        buf_[head_] = T();
+        head_ = (head_ + 1) & (buf_.size() - 1);
+        --size_;
+    }
+
+    void pop_back()
+    {
+        back() = T();
+        --size_;
+    }
+
+private:
+    void grow()
+    {
+        std::vector<T> buf(buf_.empty() ? 16 : buf_.size() * 2);    //容量保持2的幂
+        for (size_t i = 0; i < size_; ++i) {
+            buf[i] = std::move(buf_[(head_ + i) & (buf_.size() - 1)]);
+        }
+        buf_.swap(buf);
+        head_ = 0;
+    }
+
+private:
+    std::vector<T> buf_;
+    size_t         head_;
+    size_t         size_;
+};
 
 class Thread_Pool {
 public:
-    Thread_Pool(size_t, bool stop_asap = true);
+    //任务调度方式
+    enum Schedule_Mode {
+        SHARED_QUEUE,       //所有worker共用一个任务队列(一把锁), 默认方式
+        WORK_STEALING,      //每个worker一个双端队列: worker内提交的任务留在本worker, 空闲的worker从其它worker窃取
+    };
+
+    //任务优先级, 每个优先级一条队列(lane), worker总是先取高优先级的任务
+    enum Priority {
+        PRIORITY_HIGH = 0,  //延迟敏感的任务
+        PRIORITY_NORMAL,    //默认
+        PRIORITY_LOW,       //批量、后台任务
+        PRIORITY_COUNT
+    };
+
+    //队列满(达到set_capacity设置的容量)时的处理方式
+    enum Overflow_Policy {
+        OVERFLOW_BLOCK,         //提交者阻塞等待, 直到有空位. 在worker线程内提交时不阻塞(避免死锁), 直接放入
+        OVERFLOW_REJECT,        //拒绝新任务: post返回false, enqueue返回无效的future(同线程池已停止时)
+        OVERFLOW_DROP_OLDEST,   //丢弃优先级不高于新任务的最老任务, 被丢弃任务的future会得到broken_promise异常
+    };
+
+    //队列统计, 用于在内存耗尽前做负载控制
+    struct Queue_Stats {
+        size_t   depth;                         //当前排队的任务总数
+        size_t   lane_depth[PRIORITY_COUNT];    //各优先级排队的任务数
+        size_t   capacity;                      //0表示不限
+        size_t   blocked;                       //当前阻塞在OVERFLOW_BLOCK上的提交者
+        uint64_t submitted;                     //成功提交的任务数(推算值)
+        uint64_t rejected;                      //被拒绝的任务数
+        uint64_t dropped;                       //被OVERFLOW_DROP_OLDEST丢弃的任务数
+        uint64_t executed;                      //已开始执行的任务数
+        uint64_t wait_ns_total;                 //所有已执行任务的排队时间之和(纳秒)
+        uint64_t wait_ns_max;                   //最长排队时间(纳秒)
+    };
+
+    //单个worker的统计
+    struct Worker_Stats {
+        uint64_t executed;          //执行完的任务数
+        uint64_t busy_ns;           //执行任务花费的时间
+        double   utilization;       //busy_ns / 线程池运行时间
+    };
+
+    //线程池运行统计快照, 可在任意时刻、任意线程获取
+    struct Stats {
+        Queue_Stats                 queue;
+        uint64_t                    elapsed_ns;     //线程池已运行的时间
+        std::vector<Worker_Stats>   workers;
+        Latency_Histogram::Snapshot wait;           //排队时间(纳秒)直方图, 所有worker合并
+        Latency_Histogram::Snapshot run;            //执行时间(纳秒)直方图, 所有worker合并
+    };
+
+    //队列中的任务. 只能移动, 小的lambda直接存放在内部不分配内存
+    typedef Small_Function<void(), 64> Task;
+
+    Thread_Pool(size_t, bool stop_asap = true, Schedule_Mode mode = SHARED_QUEUE);
+
+    //弹性线程池: 线程数在[min_threads, max_threads]之间变化.
+    //  任务排队超过spawn_wait_us(或所有worker都超过这么久没有取到新任务)时增加worker;
+    //  worker空闲超过keepalive_ms时退出, 但至少保留min_threads个
+    Thread_Pool(size_t min_threads, size_t max_threads, unsigned keepalive_ms, unsigned spawn_wait_us,
+                bool stop_asap = true, Schedule_Mode mode = SHARED_QUEUE);
     ~Thread_Pool();
 
     template<class F, class... Args>
     auto enqueue(F&& f, Args&&... args)->std::future<decltype(f(args...))>;
 
+    //按指定优先级提交, 其它同enqueue
+    template<class F, class... Args>
+    auto enqueue_priority(Priority prio, F&& f, Args&&... args)->std::future<decltype(f(args...))>;
+
+    //提交一个不需要返回值的任务(fire-and-forget), 没有future, 一般不分配内存.
+    //线程池已停止或任务被拒绝时返回false
+    template<class F>
+    bool post(F&& f) {
+        return post(PRIORITY_NORMAL, std::forward<F>(f));
+    }
+
+    template<class F>
+    bool post(Priority prio, F&& f) {
+        return submit(prio, Task(std::forward<F>(f)));
+    }
+
+    //协程切换到线程池中执行: co_await pool.schedule(); 之后的代码在worker线程上继续.
+    //不依赖<coroutine>, await_suspend是模板, 由编译器传入coroutine_handle. 见thread_pool_coro.h
+    struct Schedule_Awaiter {
+        Thread_Pool* pool;
+        Priority     prio;
+
+        bool await_ready() const { return false; }
+
+        //线程池已停止时返回false, 协程在当前线程继续执行
+        template<typename Handle>
+        bool await_suspend(Handle h) {
+            return pool->post(prio, [h]() mutable { h.resume(); });
+        }
+
+        void await_resume() const {}
+    };
+
+    Schedule_Awaiter schedule(Priority prio = PRIORITY_NORMAL) {
+        Schedule_Awaiter a = { this, prio };
+        return a;
+    }
+
+    //提交到指定的worker执行(不会被其它worker窃取), 用于需要固定在某个线程上处理的数据, 如按worker分片的定时器.
+    //该worker不存在(弹性线程池中已退出或还未启动)时和post一样由任意worker执行. 不受队列容量限制
+    template<class F>
+    bool post_to_worker(size_t index, F&& f) {
+        return submit_to_worker(index, Task(std::forward<F>(f)));
+    }
+
+    //设置队列容量及队列满时的处理方式. capacity为0表示不限(默认).
+    //WORK_STEALING模式下各worker的队列没有统一加锁, 容量是近似值
+    void set_capacity(size_t capacity, Overflow_Policy policy = OVERFLOW_BLOCK);
+
+    //当前排队的任务数
+    size_t queue_depth() const {
+        return pending_;
+    }
+
+    size_t queue_depth(Priority prio) const {
+        return lane_pending_[prio];
+    }
+
+    Queue_Stats queue_stats() const;
+
+    //完整的统计信息: 每个worker的计数和利用率, 以及排队/执行时间直方图.
+    //计数由各worker写在自己的结构中(单写者, 不加锁), 不会给任务队列增加竞争
+    Stats stats() const;
+
     //返回cpu支持的核心数(双核返回2, 双核4线程返回4)
     inline static unsigned cpu_thread_count() {
         return std::thread::hardware_concurrency();
     }
 
+    //把worker绑定到cpus中的cpu上(cpu编号从0开始, 最大为cpu_thread_count()-1), 避免被内核迁移破坏cache局部性.
+    //one_per_worker为true时第i个worker只能在cpus[i % cpus.size()]上运行, 否则每个worker可在cpus中任一个上运行.
+    //cpus为空表示取消绑定. 仅linux有效, 成功返回0, 其它值为失败的worker数(其它平台返回-1);
+    //cpus中有负数或不小于CPU_SETSIZE的编号时返回-1, 不改变原来的设置
+    int set_cpu_affinity(const std::vector<int>& cpus, bool one_per_worker = true);
+
     void stop() {
-        stopped_ = true;
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            stopped_ = true;
+        }
+        condition_.notify_all();
+        not_full_.notify_all();
+    }
+
+    Schedule_Mode schedule_mode() const {
+        return mode_;
+    }
+
+    //线程池中worker线程的个数(弹性线程池为当前的个数)
+    size_t thread_count() const {
+        return live_;
+    }
+
+    size_t min_threads() const {
+        return min_threads_;
+    }
+
+    size_t max_threads() const {
+        return max_threads_;
+    }
+
+    //当前线程是否为本线程池的worker
+    bool in_worker_thread() const {
+        return current_worker().pool == this;
+    }
+
+    //当前线程是本线程池的第几个worker(0 ~ max_threads()-1), 不是本线程池的worker时返回NOT_WORKER
+    enum { NOT_WORKER = -1 };
+    size_t current_worker_index() const {
+        return in_worker_thread() ? current_worker().index : static_cast<size_t>(NOT_WORKER);
     }
 
 private:
-    void schedule_worker();
+    //排队中的任务, 记录入队时间用于统计排队时长
+    struct Queued_Task {
+        Task    fn;
+        int64_t enqueue_ns;
+    };
+
+    //WORK_STEALING模式
+    struct Worker_Queue {
+        std::mutex mutex;
+        Ring_Deque<Queued_Task> tasks;
+    };
+
+    //每个worker自己的计数, 只有该worker写, 其它线程读. 末尾填充避免和相邻worker伪共享
+    struct Worker_Counters {
+        std::atomic<uint64_t> executed;
+        std::atomic<uint64_t> busy_ns;
+        std::atomic<int64_t>  last_take_ns;     //最近一次取到任务的时间
+        Latency_Histogram     wait;
+        Latency_Histogram     run;
+        char                  pad[64];
+
+        Worker_Counters() : executed(0), busy_ns(0), last_take_ns(0) {}
+    };
+
+    //只能由指定worker执行的任务, 由queue_mutex_保护. count和accepting可以不加锁读
+    struct Pinned_Queue {
+        Ring_Deque<Queued_Task> tasks;
+        std::atomic<size_t>     count;
+        std::atomic<bool>       accepting;  //worker正在运行, 可以接收任务
+        char                    pad[64];
+
+        Pinned_Queue() : count(0), accepting(false) {}
+    };
+
+    //worker槽位状态, 由workers_mutex_保护
+    enum Slot_State {
+        SLOT_EMPTY = 0,     //从未使用
+        SLOT_RUNNING,
+        SLOT_RETIRED,       //worker空闲超时已退出, 线程对象待join
+    };
+
+    //记录当前线程属于哪个线程池的第几个worker, 非worker线程pool为nullptr
+    struct Worker_Context {
+        const Thread_Pool* pool;
+        size_t             index;
+    };
+    static Worker_Context& current_worker() {
+        static thread_local Worker_Context ctx = { nullptr, 0 };
+        return ctx;
+    }
+
+    static int64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void schedule_worker(size_t index);
+    void stealing_worker(size_t index);
+
+    bool submit(Priority prio, Task&& task);
+    bool add_task(Priority prio, Task&& task);
+    bool submit_to_worker(size_t index, Task&& task);
+    bool pop_pinned(size_t index, Queued_Task& task);
+    bool make_room(Priority prio, std::unique_lock<std::mutex>& lock, Task& victim);
+    bool drop_oldest(Priority prio, Task& victim);
+    void push_task(Task&& task);
+    bool pop_task(size_t index, Queued_Task& task);
+    bool pop_lane(Priority prio, Queued_Task& task);
+    int  apply_cpu_affinity(size_t index);
+    void task_taken();
+    void run_task(size_t index, Queued_Task& task);
+    bool idle_wait(size_t index, std::unique_lock<std::mutex>& lock);
+    bool spawn_worker();
+    void retire_worker(size_t index);
+    void check_stalled();
 
 private:
-    // need to keep track of threads so we can join them
+    // need to keep track of threads so we can join them. 按max_threads分配槽位, 由workers_mutex_保护
     std::vector< std::thread > workers_;
-    // the task queue
-    std::queue< std::function<void()> > tasks_;
+    std::vector<char>          slot_state_;
+    std::mutex                 workers_mutex_;
+    // the task queue: 每个优先级一条. WORK_STEALING模式下PRIORITY_NORMAL的任务放在各worker的队列中
+    Ring_Deque<Queued_Task> lanes_[PRIORITY_COUNT];
     
     // synchronization
     std::mutex queue_mutex_;
     std::condition_variable condition_;
-    volatile bool stopped_;
+    std::condition_variable not_full_;      //OVERFLOW_BLOCK时等待队列有空位
+    std::atomic<bool> stopped_;
     volatile bool stop_asap_;   //worker quit ASAP when stopped_ is true, otherwise we should wait worker finish work
+
+    //WORK_STEALING模式: 每个worker一个队列, queue_mutex_/condition_只用于空闲worker的休眠和唤醒
+    Schedule_Mode mode_;
+    std::unique_ptr<Worker_Queue[]> queues_;
+    size_t              queue_count_;
+    std::atomic<size_t> pending_;       //所有队列中的任务总数
+    std::atomic<size_t> lane_pending_[PRIORITY_COUNT];
+    std::atomic<size_t> idle_;          //正在休眠的worker数, 为0时提交任务不必加锁通知
+    std::atomic<size_t> next_queue_;    //外部线程提交任务时轮流放入各worker的队列
+    std::unique_ptr<Pinned_Queue[]> pinned_;    //post_to_worker的任务, 不计入pending_
+
+    //容量控制及统计
+    std::atomic<size_t>   capacity_;
+    Overflow_Policy       policy_;
+    std::atomic<size_t>   blocked_;
+    std::atomic<uint64_t> rejected_;
+    std::atomic<uint64_t> dropped_;
+
+    //运行统计
+    std::unique_ptr<Worker_Counters[]> counters_;
+    int64_t start_ns_;
+
+    //cpu绑定, 由workers_mutex_保护
+    std::vector<int> cpus_;
+    bool             cpu_per_worker_;
+
+    //弹性伸缩
+    const size_t         min_threads_;
+    const size_t         max_threads_;
+    const unsigned       keepalive_ms_;
+    const int64_t        spawn_wait_ns_;
+    std::atomic<size_t>  live_;                 //正在运行的worker数
+    std::atomic<size_t>  slots_used_;           //用到过的最大槽位数, 统计时遍历
+    std::atomic<int64_t> next_stall_check_ns_;  //限制check_stalled的频率
 };
  
 // the constructor just launches some amount of workers
-inline Thread_Pool::Thread_Pool(size_t threads, bool stop_asap)
-    :stopped_(false)
+inline Thread_Pool::Thread_Pool(size_t threads, bool stop_asap, Schedule_Mode mode)
+    :Thread_Pool(threads, threads, 0, 0, stop_asap, mode)
+{
+}
+
+inline Thread_Pool::Thread_Pool(size_t min_threads, size_t max_threads, unsigned keepalive_ms, unsigned spawn_wait_us,
+                                bool stop_asap, Schedule_Mode mode)
+    :workers_((std::max)(min_threads, max_threads))
+    ,slot_state_(workers_.size(), SLOT_EMPTY)
+    ,stopped_(false)
     ,stop_asap_(stop_asap)
+    ,mode_(mode)
+    ,queue_count_(0)
+    ,pending_(0)
+    ,idle_(0)
+    ,next_queue_(0)
+    ,pinned_(new Pinned_Queue[workers_.size()])
+    ,capacity_(0)
+    ,policy_(OVERFLOW_BLOCK)
+    ,blocked_(0)
+    ,rejected_(0)
+    ,dropped_(0)
+    ,counters_(new Worker_Counters[workers_.size()])
+    ,start_ns_(now_ns())
+    ,cpu_per_worker_(false)
+    ,min_threads_(min_threads)
+    ,max_threads_(workers_.size())
+    ,keepalive_ms_(keepalive_ms)
+    ,spawn_wait_ns_(static_cast<int64_t>(spawn_wait_us) * 1000)
+    ,live_(0)
+    ,slots_used_(0)
+    ,next_stall_check_ns_(0)
 {
-    for (size_t i = 0; i<threads; ++i) {
-        workers_.emplace_back(&Thread_Pool::schedule_worker, this);
+    for (int p = 0; p < PRIORITY_COUNT; ++p) {
+        lane_pending_[p] = 0;
+    }
+
+    if (mode_ == WORK_STEALING) {
+        //每个槽位一个队列, 已退出的worker的队列中的任务会被其它worker窃取
+        queues_.reset(new Worker_Queue[max_threads_]);
+        queue_count_ = max_threads_;
+    }
+
+    for (size_t i = 0; i < min_threads_; ++i) {
+        spawn_worker();
     }
 }
 
-void Thread_Pool::schedule_worker()
+inline void Thread_Pool::schedule_worker(size_t index)
 {
+    current_worker().pool  = this;
+    current_worker().index = index;
+
+    Queued_Task task;
     for (;;) {
         std::unique_lock<std::mutex> lock(queue_mutex_);
-        condition_.wait(lock, [this]{ return this->stopped_ || !this->tasks_.empty(); });
+        if (!stopped_ && pending_ == 0 && pinned_[index].count == 0 && !idle_wait(index, lock)) {
+            lock.unlock();
+            retire_worker(index);
+            return;
+        }
         if (stopped_ && stop_asap_) {
             return;
         }
-        if (!tasks_.empty()) {
-            std::function<void()> task = tasks_.front();
-            tasks_.pop();
+        Pinned_Queue& pinned = pinned_[index];
+        if (!pinned.tasks.empty()) {
+            task = std::move(pinned.tasks.front());
+            pinned.tasks.pop_front();
+            --pinned.count;
             lock.unlock();
-            task();
+            run_task(index, task);
+            continue;
+        }
+        if (pending_ > 0) {
+            for (int p = 0; p < PRIORITY_COUNT; ++p) {
+                if (!lanes_[p].empty()) {
+                    task = std::move(lanes_[p].front());
+                    lanes_[p].pop_front();
+                    --lane_pending_[p];
+                    break;
+                }
+            }
+            task_taken();
+            lock.unlock();
+            run_task(index, task);
             continue;
         }
         if (stopped_) {
@@ -81,37 +481,560 @@ void Thread_Pool::schedule_worker()
     }
 }
 
+inline void Thread_Pool::stealing_worker(size_t index)
+{
+    current_worker().pool  = this;
+    current_worker().index = index;
+
+    Queued_Task task;
+    for (;;) {
+        if (stopped_ && stop_asap_) {
+            return;
+        }
+        if (pop_task(index, task)) {
+            run_task(index, task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        if (!idle_wait(index, lock)) {
+            lock.unlock();
+            retire_worker(index);
+            return;
+        }
+        if (stopped_ && (stop_asap_ || (pending_ == 0 && pinned_[index].count == 0))) {
+            return;
+        }
+    }
+}
+
+//空闲时等待新任务, 调用前已持有queue_mutex_.
+//返回false表示空闲超过keepalive_ms_且线程数多于min_threads_, 该worker应当退出(live_已减1)
+inline bool Thread_Pool::idle_wait(size_t index, std::unique_lock<std::mutex>& lock)
+{
+    Pinned_Queue& pinned = pinned_[index];
+    auto ready = [this, &pinned]{ return this->stopped_ || this->pending_ > 0 || pinned.count > 0; };
+
+    ++idle_;    //先增加idle_再检查pending_, 与push_task的顺序相反, 保证不会漏掉唤醒
+    for (;;) {
+        if (keepalive_ms_ == 0 || live_ <= min_threads_) {
+            condition_.wait(lock, ready);
+            break;
+        }
+        if (condition_.wait_for(lock, std::chrono::milliseconds(keepalive_ms_), ready)) {
+            break;
+        }
+        size_t n = live_;
+        if (n > min_threads_ && live_.compare_exchange_strong(n, n - 1)) {
+            pinned.accepting = false;   //持有queue_mutex_且pinned为空, 之后post_to_worker会转给其它worker
+            --idle_;
+            return false;
+        }
+    }
+    --idle_;
+    return true;
+}
+
+//启动一个新的worker, 已达max_threads_或已停止时返回false
+inline bool Thread_Pool::spawn_worker()
+{
+    std::lock_guard<std::mutex> lock(workers_mutex_);
+    if (stopped_ || live_ >= max_threads_) {
+        return false;
+    }
+
+    size_t i = 0;
+    while (i < max_threads_ && slot_state_[i] == SLOT_RUNNING) {
+        ++i;
+    }
+    if (i == max_threads_) {
+        return false;   //有worker正在退出, 槽位还没释放
+    }
+    if (workers_[i].joinable()) {
+        workers_[i].join();     //之前空闲退出的worker, 此时已经(或马上)结束
+    }
+
+    slot_state_[i] = SLOT_RUNNING;
+    pinned_[i].accepting = true;
+    ++live_;
+    if (mode_ == WORK_STEALING) {
+        workers_[i] = std::thread(&Thread_Pool::stealing_worker, this, i);
+    } else {
+        workers_[i] = std::thread(&Thread_Pool::schedule_worker, this, i);
+    }
+    if (!cpus_.empty()) {
+        apply_cpu_affinity(i);
+    }
+    if (i >= slots_used_) {
+        slots_used_ = i + 1;
+    }
+    return true;
+}
+
+//worker空闲超时退出, 释放槽位. 线程对象在槽位重用或析构时join
+inline void Thread_Pool::retire_worker(size_t index)
+{
+    std::lock_guard<std::mutex> lock(workers_mutex_);
+    slot_state_[index] = SLOT_RETIRED;
+}
+
+//提交任务时所有worker都在忙: 如果它们都已超过spawn_wait_ns_没有取新任务(都卡在耗时的任务上), 增加一个worker
+inline void Thread_Pool::check_stalled()
+{
+    int64_t now  = now_ns();
+    int64_t next = next_stall_check_ns_;
+    if (now < next || !next_stall_check_ns_.compare_exchange_strong(next, now + spawn_wait_ns_)) {
+        return;
+    }
+
+    size_t used = slots_used_;
+    for (size_t i = 0; i < used; ++i) {
+        if (now - counters_[i].last_take_ns.load(std::memory_order_relaxed) < spawn_wait_ns_) {
+            return;
+        }
+    }
+    spawn_worker();
+}
+
+//任务已从队列取出: 更新计数, 唤醒因队列满而阻塞的提交者
+inline void Thread_Pool::task_taken()
+{
+    --pending_;
+    if (blocked_ > 0) {
+        if (mode_ == WORK_STEALING) {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            not_full_.notify_one();
+        } else {
+            not_full_.notify_one();     //SHARED_QUEUE模式调用者已持有queue_mutex_
+        }
+    }
+}
+
+inline void Thread_Pool::run_task(size_t index, Queued_Task& task)
+{
+    Worker_Counters& c = counters_[index];
+    int64_t begin = now_ns();
+    int64_t wait  = begin - task.enqueue_ns;
+    c.wait.record(static_cast<uint64_t>(wait));
+    c.last_take_ns.store(begin, std::memory_order_relaxed);
+
+    //排队时间超过阈值, 说明worker不够用了
+    if (wait > spawn_wait_ns_ && max_threads_ > min_threads_ &&
+        idle_ == 0 && pending_ > 0 && live_ < max_threads_)
+    {
+        spawn_worker();
+    }
+
+    task.fn();
+    task.fn = nullptr;
+
+    uint64_t used = static_cast<uint64_t>(now_ns() - begin);
+    c.run.record(used);
+    c.busy_ns.store(c.busy_ns.load(std::memory_order_relaxed) + used, std::memory_order_relaxed);
+    c.executed.store(c.executed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+inline bool Thread_Pool::submit(Priority prio, Task&& task)
+{
+    bool ok = add_task(prio, std::move(task));
+    if (ok && max_threads_ > min_threads_ && idle_ == 0 && live_ < max_threads_) {
+        check_stalled();
+    }
+    return ok;
+}
+
+inline bool Thread_Pool::add_task(Priority prio, Task&& task)
+{
+    Task victim;    //被丢弃的任务在解锁后才析构, 避免其析构函数里再提交任务造成死锁
+
+    if (mode_ == WORK_STEALING) {
+        if (stopped_) {
+            return false;
+        }
+        if (capacity_ > 0 && pending_ >= capacity_) {
+            std::unique_lock<std::mutex> lock(queue_mutex_);
+            if (!make_room(prio, lock, victim)) {
+                return false;
+            }
+        }
+        if (prio == PRIORITY_NORMAL) {
+            push_task(std::move(task));
+            return true;
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(queue_mutex_);
+
+    // don't allow enqueueing after stopping the pool
+    if (stopped_) {
+        return false;
+    }
+    if (mode_ == SHARED_QUEUE && !make_room(prio, lock, victim)) {
+        return false;
+    }
+
+    Queued_Task t = { std::move(task), now_ns() };
+    lanes_[prio].push_back(std::move(t));
+    ++lane_pending_[prio];
+    ++pending_;
+
+    if (mode_ == SHARED_QUEUE || idle_ > 0) {
+        condition_.notify_one(); //notify前最好是先锁住, see:http://stackoverflow.com/questions/17101922/do-i-have-to-acquire-lock-before-calling-condition-variable-notify-one
+    }
+    return true;
+}
+
+//调用前已持有queue_mutex_. 队列满时按policy_处理, 返回false表示不能提交
+inline bool Thread_Pool::make_room(Priority prio, std::unique_lock<std::mutex>& lock, Task& victim)
+{
+    if (capacity_ == 0 || pending_ < capacity_) {
+        return true;
+    }
+
+    switch (policy_) {
+    case OVERFLOW_REJECT:
+        break;
+
+    case OVERFLOW_BLOCK:
+        if (in_worker_thread()) {
+            return true;    //worker等待自己的线程池会死锁
+        }
+        ++blocked_;
+        not_full_.wait(lock, [this]{ return this->stopped_ || this->capacity_ == 0 || this->pending_ < this->capacity_; });
+        --blocked_;
+        if (!stopped_) {
+            return true;
+        }
+        break;
+
+    case OVERFLOW_DROP_OLDEST:
+        if (drop_oldest(prio, victim)) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        break;
+    }
+
+    rejected_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+//从优先级不高于prio的队列中, 按优先级从低到高找到最老的任务丢弃. 调用前已持有queue_mutex_
+inline bool Thread_Pool::drop_oldest(Priority prio, Task& victim)
+{
+    for (int p = PRIORITY_COUNT - 1; p >= prio; --p) {
+        if (mode_ == WORK_STEALING && p == PRIORITY_NORMAL) {
+            for (size_t i = 0; i < queue_count_; ++i) {
+                Worker_Queue& q = queues_[i];
+                std::lock_guard<std::mutex> qlock(q.mutex);
+                if (!q.tasks.empty()) {
+                    victim = std::move(q.tasks.front().fn);
+                    q.tasks.pop_front();
+                    --lane_pending_[p];
+                    --pending_;
+                    return true;
+                }
+            }
+            continue;
+        }
+
+        if (!lanes_[p].empty()) {
+            victim = std::move(lanes_[p].front().fn);
+            lanes_[p].pop_front();
+            --lane_pending_[p];
+            --pending_;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void Thread_Pool::push_task(Task&& task)
+{
+    //worker内提交的任务放入自己的队列, 外部提交的任务轮流放入正在运行的worker的队列.
+    //空槽位和已退出worker的队列没有主人, 任务只能等别的worker空闲时来窃取
+    const Worker_Context& ctx = current_worker();
+    size_t index = ctx.index;
+    if (ctx.pool != this) {
+        size_t n = slots_used_;
+        if (n == 0) {
+            n = queue_count_;
+        }
+        index = next_queue_++ % n;
+        for (size_t i = 0; i < n; ++i) {
+            size_t k = (index + i) % n;
+            if (pinned_[k].accepting) {     //accepting与SLOT_RUNNING同步变化, 不用锁workers_mutex_
+                index = k;
+                break;
+            }
+        }
+    }
+    {
+        Queued_Task t = { std::move(task), now_ns() };
+        std::lock_guard<std::mutex> lock(queues_[index].mutex);
+        queues_[index].tasks.push_back(std::move(t));
+        ++lane_pending_[PRIORITY_NORMAL];
+        ++pending_;
+    }
+
+    if (idle_ > 0) {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        condition_.notify_one();
+    }
+}
+
+//WORK_STEALING模式取任务: 高优先级队列 -> 自己的队列 -> 窃取其它worker -> 低优先级队列
+inline bool Thread_Pool::pop_task(size_t index, Queued_Task& task)
+{
+    if (pinned_[index].count > 0 && pop_pinned(index, task)) {
+        return true;
+    }
+    if (pending_ == 0) {
+        return false;
+    }
+
+    if (lane_pending_[PRIORITY_HIGH] > 0 && pop_lane(PRIORITY_HIGH, task)) {
+        return true;
+    }
+
+    //自己的队列后进先出(刚提交的任务数据还在cache中), 窃取时从其它队列头部拿最老的任务.
+    //task_taken()可能要锁queue_mutex_, 必须在释放worker队列的锁之后调用(drop_oldest是先锁queue_mutex_)
+    bool got = false;
+    {
+        Worker_Queue& q = queues_[index];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty()) {
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            --lane_pending_[PRIORITY_NORMAL];
+            got = true;
+        }
+    }
+
+    const size_t n = queue_count_;
+    for (size_t i = 1; i < n && !got; ++i) {
+        Worker_Queue& q = queues_[(index + i) % n];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.tasks.empty()) {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            --lane_pending_[PRIORITY_NORMAL];
+            got = true;
+        }
+    }
+
+    if (got) {
+        task_taken();
+        return true;
+    }
+
+    if (lane_pending_[PRIORITY_LOW] > 0 && pop_lane(PRIORITY_LOW, task)) {
+        return true;
+    }
+    return false;
+}
+
+inline bool Thread_Pool::submit_to_worker(size_t index, Task&& task)
+{
+    if (index < max_threads_) {
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        if (stopped_) {
+            return false;
+        }
+        Pinned_Queue& q = pinned_[index];
+        if (q.accepting) {
+            Queued_Task t = { std::move(task), now_ns() };
+            q.tasks.push_back(std::move(t));
+            ++q.count;
+            //不知道哪个休眠的worker是目标, 只能全部唤醒, 其它worker检查条件后继续休眠
+            if (idle_ > 0) {
+                condition_.notify_all();
+            }
+            return true;
+        }
+    }
+    return submit(PRIORITY_NORMAL, std::move(task));
+}
+
+inline bool Thread_Pool::pop_pinned(size_t index, Queued_Task& task)
+{
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    Pinned_Queue& q = pinned_[index];
+    if (q.tasks.empty()) {
+        return false;
+    }
+    task = std::move(q.tasks.front());
+    q.tasks.pop_front();
+    --q.count;
+    return true;
+}
+
+inline bool Thread_Pool::pop_lane(Priority prio, Queued_Task& task)
+{
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    if (lanes_[prio].empty()) {
+        return false;
+    }
+    task = std::move(lanes_[prio].front());
+    lanes_[prio].pop_front();
+    --lane_pending_[prio];
+    --pending_;
+    if (blocked_ > 0) {
+        not_full_.notify_one();
+    }
+    return true;
+}
+
+inline void Thread_Pool::set_capacity(size_t capacity, Overflow_Policy policy)
+{
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        capacity_ = capacity;
+        policy_   = policy;
+    }
+    not_full_.notify_all();
+}
+
+inline int Thread_Pool::set_cpu_affinity(const std::vector<int>& cpus, bool one_per_worker)
+{
+#ifdef __linux__
+    //CPU_SET不检查范围, 越界会写到cpu_set_t外面
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE) {
+            return -1;
+        }
+    }
+#endif
+
+    std::lock_guard<std::mutex> lock(workers_mutex_);
+    cpus_           = cpus;
+    cpu_per_worker_ = one_per_worker;
+
+    int failed = 0;
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        if (slot_state_[i] == SLOT_RUNNING && apply_cpu_affinity(i) != 0) {
+            ++failed;
+        }
+    }
+    return failed;
+}
+
+//按cpus_设置第index个worker的亲和性, 调用前已持有workers_mutex_
+inline int Thread_Pool::apply_cpu_affinity(size_t index)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (cpus_.empty()) {
+        for (unsigned i = 0; i < cpu_thread_count() && i < CPU_SETSIZE; ++i) {
+            CPU_SET(i, &set);
+        }
+    } else if (cpu_per_worker_) {
+        CPU_SET(cpus_[index % cpus_.size()], &set);
+    } else {
+        for (size_t i = 0; i < cpus_.size(); ++i) {
+            CPU_SET(cpus_[i], &set);
+        }
+    }
+    return pthread_setaffinity_np(workers_[index].native_handle(), sizeof(set), &set);
+#else
+    (void)index;
+    return -1;
+#endif
+}
+
+inline Thread_Pool::Queue_Stats Thread_Pool::queue_stats() const
+{
+    Queue_Stats s;
+    s.depth = pending_;
+    for (int p = 0; p < PRIORITY_COUNT; ++p) {
+        s.lane_depth[p] = lane_pending_[p];
+    }
+    s.capacity      = capacity_;
+    s.blocked       = blocked_;
+    s.rejected      = rejected_.load(std::memory_order_relaxed);
+    s.dropped       = dropped_.load(std::memory_order_relaxed);
+    s.executed      = 0;
+    s.wait_ns_total = 0;
+    s.wait_ns_max   = 0;
+    for (size_t i = 0; i < slots_used_; ++i) {
+        const Worker_Counters& c = counters_[i];
+        s.executed      += c.wait.count();
+        s.wait_ns_total += c.wait.sum();
+        if (c.wait.max() > s.wait_ns_max) {
+            s.wait_ns_max = c.wait.max();
+        }
+    }
+    //提交数不单独计数(避免每次提交都写同一个原子变量), 由已执行+排队中+被丢弃推算
+    s.submitted = s.executed + s.depth + s.dropped;
+    return s;
+}
+
+inline Thread_Pool::Stats Thread_Pool::stats() const
+{
+    Stats s;
+    s.queue      = queue_stats();
+    s.elapsed_ns = static_cast<uint64_t>(now_ns() - start_ns_);
+    s.workers.resize(slots_used_);
+    for (size_t i = 0; i < s.workers.size(); ++i) {
+        const Worker_Counters& c = counters_[i];
+        Worker_Stats& w = s.workers[i];
+        w.executed    = c.executed.load(std::memory_order_relaxed);
+        w.busy_ns     = c.busy_ns.load(std::memory_order_relaxed);
+        w.utilization = s.elapsed_ns ? static_cast<double>(w.busy_ns) / s.elapsed_ns : 0.0;
+        c.wait.snapshot(s.wait);
+        c.run.snapshot(s.run);
+    }
+    return s;
+}
+
 // add new work item to the pool
 template<class F, class... Args>
 auto Thread_Pool::enqueue(F&& f, Args&&... args) -> std::future<decltype(f(args...))>
+{
+    return enqueue_priority(PRIORITY_NORMAL, std::forward<F>(f), std::forward<Args>(args)...);
+}
+
+template<class F, class... Args>
+auto Thread_Pool::enqueue_priority(Priority prio, F&& f, Args&&... args) -> std::future<decltype(f(args...))>
 {
     using return_type = decltype(f(args...));
 
-    auto task = std::make_shared< std::packaged_task<return_type()> >(
+    //packaged_task可以移动, 直接放入Task, 不再需要shared_ptr包一层
+    std::packaged_task<return_type()> task(
             std::bind(std::forward<F>(f), std::forward<Args>(args)...)
         );
 
-    std::future<return_type> res = task->get_future();
-    //{
-        std::unique_lock<std::mutex> lock(queue_mutex_);
-
-        // don't allow enqueueing after stopping the pool
-        if (stopped_) {
-            return std::future<return_type>();  //改为不抛异常，但外围要用 valid()检查后再get()
-            //throw std::runtime_error("enqueue on stopped ThreadPool");
-        }
-        tasks_.emplace([task](){ (*task)(); });
-    //}
-    condition_.notify_one(); //notify前最好是先锁住, see:http://stackoverflow.com/questions/17101922/do-i-have-to-acquire-lock-before-calling-condition-variable-notify-one
+    std::future<return_type> res = task.get_future();
+    if (!post(prio, std::move(task))) {
+        return std::future<return_type>();  //改为不抛异常，但外围要用 valid()检查后再get()
+        //throw std::runtime_error("enqueue on stopped ThreadPool");
+    }
     return res;
 }
 
 // the destructor joins all threads
 inline Thread_Pool::~Thread_Pool()
 {
-    stopped_ = true;
+    {
+        //加锁修改, 避免worker检查完条件、还未进入wait时错过这次notify
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        stopped_ = true;
+    }
     condition_.notify_all();
-    for (std::thread &worker : workers_) {
+    not_full_.notify_all();
+
+    //不能持有workers_mutex_去join: 正在退出的worker需要它来释放槽位
+    std::vector< std::thread > threads;
+    {
+        std::lock_guard<std::mutex> lock(workers_mutex_);
+        for (std::thread &worker : workers_) {
+            if (worker.joinable()) {
+                threads.push_back(std::move(worker));
+            }
+        }
+    }
+    for (std::thread &worker : threads) {
         worker.join();
     }
 }
@@ -0,0 +1,70 @@
+//Thread_Pool提交任务的微基准: 1M个任务, 每个任务把一个原子变量加1, 统计吞吐和每个任务的内存分配次数
+//编译: g++ -std=c++11 -O2 -pthread thread_pool_bench.cpp -o thread_pool_bench
+//用法: thread_pool_bench [任务数] [线程数]
+
+#include "thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <new>
+
+static std::atomic<long> g_allocs(0);
+
+void* operator new(size_t n)
+{
+    ++g_allocs;
+    void* p = malloc(n ? n : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+template<typename Submit>
+static void run(const char* name, Thread_Pool::Schedule_Mode mode, int tasks, int threads, Submit submit)
+{
+    std::atomic<long> done(0);
+    long allocs;
+
+    auto t0 = std::chrono::steady_clock::now();
+    {
+        Thread_Pool pool(threads, false, mode);
+        allocs = g_allocs;
+        for (int i = 0; i < tasks; ++i) {
+            submit(pool, done);
+        }
+        while (done < tasks) {
+            std::this_thread::yield();
+        }
+        allocs = g_allocs - allocs;
+    }
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    printf("%-10s %-7s %10.0f tasks/s  %.2f allocs/task\n",
+           name, mode == Thread_Pool::WORK_STEALING ? "steal" : "shared", tasks / s, double(allocs) / tasks);
+}
+
+int main(int argc, char** argv)
+{
+    int tasks   = argc > 1 ? atoi(argv[1]) : 1000000;
+    int threads = argc > 2 ? atoi(argv[2]) : 4;
+
+    Thread_Pool::Schedule_Mode modes[] = { Thread_Pool::SHARED_QUEUE, Thread_Pool::WORK_STEALING };
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i) {
+        run("enqueue", modes[i], tasks, threads, [](Thread_Pool& pool, std::atomic<long>& done) {
+            pool.enqueue([&done] { ++done; });
+        });
+        run("post", modes[i], tasks, threads, [](Thread_Pool& pool, std::atomic<long>& done) {
+            pool.post([&done] { ++done; });
+        });
+    }
+    return 0;
+}
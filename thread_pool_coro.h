@@ -0,0 +1,370 @@
+#ifndef _THREAD_POOL_CORO_H_
+#define _THREAD_POOL_CORO_H_
+
+//基于Thread_Pool的C++20协程
+//  Co_Task<T>: 惰性启动的协程任务, 可以在另一个协程中co_await, 也可以用co_spawn提交到线程池
+//  等待期间协程挂起, 只占用一个协程帧, 不占用worker线程; 等待结束后在线程池的worker上恢复执行
+//用法:
+//  Co_Task<int> handler(Thread_Pool& pool, Co_Timer& timer) {
+//      co_await pool.schedule();                       //切换到worker线程
+//      co_await timer.sleep_for(100);                  //100毫秒后在worker上继续
+//      Child_Exit e = co_await wait_child_exit(*Process_Manager::instance(), pool, "/tmp", "ls");
+//      co_return e.status;
+//  }
+//  std::future<int> f = co_spawn(pool, handler(pool, timer));
+//注意:
+//  1. 需要编译器支持协程(-std=c++20), 否则本文件为空
+//  2. Timer_wheel不是线程安全的, 由Co_Timer加锁包装, 需要有一个线程循环调用Co_Timer::expire()
+
+#include "thread_pool.h"
+#include "timer_wheel.h"
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <string>
+#include <sys/time.h>
+#include <sys/types.h>
+
+template<typename T = void>
+class Co_Task;
+
+namespace coro_detail {
+
+struct Promise_Base {
+    std::coroutine_handle<> continuation;   //co_await本任务的协程, 本任务结束后接着执行它
+    std::exception_ptr      error;
+
+    //结束时直接切换到continuation(对称转移), 不会随着co_await层数增加而加深调用栈
+    struct Final_Awaiter {
+        bool await_ready() noexcept { return false; }
+
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+            std::coroutine_handle<> c = h.promise().continuation;
+            return c ? c : std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    Final_Awaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() {
+        error = std::current_exception();
+    }
+};
+
+template<typename T>
+struct Promise : Promise_Base {
+    std::optional<T> value;
+
+    Co_Task<T> get_return_object();
+
+    template<typename U>
+    void return_value(U&& v) {
+        value.emplace(std::forward<U>(v));
+    }
+
+    T result() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+};
+
+template<>
+struct Promise<void> : Promise_Base {
+    Co_Task<void> get_return_object();
+
+    void return_void() {}
+
+    void result() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+//co_spawn用的协程: 立即执行, 结束后自己销毁
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+} //namespace coro_detail
+
+template<typename T>
+class Co_Task
+{
+public:
+    typedef coro_detail::Promise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    Co_Task() : handle_(nullptr) {}
+    explicit Co_Task(Handle h) : handle_(h) {}
+
+    Co_Task(Co_Task&& other) noexcept : handle_(other.handle_) {
+        other.handle_ = nullptr;
+    }
+
+    Co_Task& operator=(Co_Task&& other) noexcept
+    {
+        if (this != &other) {
+            if (handle_) {
+                handle_.destroy();
+            }
+            handle_ = other.handle_;
+            other.handle_ = nullptr;
+        }
+        return *this;
+    }
+
+    Co_Task(const Co_Task&) = delete;
+    Co_Task& operator=(const Co_Task&) = delete;
+
+    ~Co_Task()
+    {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    bool valid() const {
+        return handle_ != nullptr;
+    }
+
+    //co_await task: 在当前线程开始执行task, task结束后在它结束的线程上继续执行调用者
+    struct Awaiter {
+        Handle handle;
+
+        bool await_ready() const noexcept {
+            return !handle || handle.done();
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+            handle.promise().continuation = caller;
+            return handle;
+        }
+
+        T await_resume() {
+            return handle.promise().result();
+        }
+    };
+
+    Awaiter operator co_await() const & noexcept {
+        return Awaiter{ handle_ };
+    }
+
+    Awaiter operator co_await() const && noexcept {
+        return Awaiter{ handle_ };
+    }
+
+private:
+    Handle handle_;
+};
+
+namespace coro_detail {
+
+template<typename T>
+inline Co_Task<T> Promise<T>::get_return_object() {
+    return Co_Task<T>(std::coroutine_handle<Promise<T> >::from_promise(*this));
+}
+
+inline Co_Task<void> Promise<void>::get_return_object() {
+    return Co_Task<void>(std::coroutine_handle<Promise<void> >::from_promise(*this));
+}
+
+template<typename T>
+Detached spawn(Thread_Pool& pool, Co_Task<T> task, std::promise<T> p)
+{
+    co_await pool.schedule();
+    try {
+        p.set_value(co_await std::move(task));
+    } catch (...) {
+        p.set_exception(std::current_exception());
+    }
+}
+
+inline Detached spawn(Thread_Pool& pool, Co_Task<void> task, std::promise<void> p)
+{
+    co_await pool.schedule();
+    try {
+        co_await std::move(task);
+        p.set_value();
+    } catch (...) {
+        p.set_exception(std::current_exception());
+    }
+}
+
+} //namespace coro_detail
+
+//在线程池中开始执行task, 通过future取结果. 线程池已停止时task在调用线程上执行
+template<typename T>
+std::future<T> co_spawn(Thread_Pool& pool, Co_Task<T> task)
+{
+    std::promise<T> p;
+    std::future<T> f = p.get_future();
+    coro_detail::spawn(pool, std::move(task), std::move(p));
+    return f;
+}
+
+//在线程池上恢复协程, 线程池已停止时在当前线程恢复
+inline void resume_on(Thread_Pool& pool, std::coroutine_handle<> h)
+{
+    if (!pool.post([h]() { h.resume(); })) {
+        h.resume();
+    }
+}
+
+//可以co_await的定时器: 到期后协程在线程池上恢复
+class Co_Timer
+{
+public:
+    explicit Co_Timer(Thread_Pool& pool) : pool_(pool) {}
+
+    Co_Timer(const Co_Timer&) = delete;
+    Co_Timer& operator=(const Co_Timer&) = delete;
+
+    struct Sleep_Awaiter {
+        Co_Timer*     timer;
+        unsigned long ms;
+
+        bool await_ready() const {
+            return ms == 0;
+        }
+
+        //添加定时器失败时返回false, 协程立即继续
+        bool await_suspend(std::coroutine_handle<> h) {
+            return timer->add(ms, h);
+        }
+
+        void await_resume() const {}
+    };
+
+    //co_await timer.sleep_for(ms);
+    Sleep_Awaiter sleep_for(unsigned long ms) {
+        return Sleep_Awaiter{ this, ms };
+    }
+
+    //触发到期的定时器, 由驱动线程循环调用, 一般间隔1毫秒.
+    //持锁只收集到期的回调, 解锁后再执行: 线程池停止时协程在这里直接恢复, 可能再次sleep_for
+    int expire(const timeval* tv)
+    {
+        Timer_Batch batch;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            wheel_.expire(tv, batch);
+        }
+        for (size_t i = 0; i < batch.size(); ++i) {
+            batch[i]();
+        }
+        return static_cast<int>(batch.size());
+    }
+
+    int expire()
+    {
+        timeval tv;
+        gettimeofday(&tv, NULL);
+        return expire(&tv);
+    }
+
+private:
+    //回调在expire中解锁后执行, 可能早于本函数返回, 因此加入后不再访问awaiter
+    bool add(unsigned long ms, std::coroutine_handle<> h)
+    {
+        timeval tv;
+        gettimeofday(&tv, NULL);
+        unsigned long usec = tv.tv_usec + (ms % 1000) * 1000;
+        tv.tv_sec  += ms / 1000 + usec / 1000000;
+        tv.tv_usec  = usec % 1000000;
+
+        Thread_Pool* pool = &pool_;
+        std::lock_guard<std::mutex> lock(mutex_);
+        return wheel_.schedule(&tv, 0, [pool, h]() { resume_on(*pool, h); }) != NULL;
+    }
+
+private:
+    Thread_Pool& pool_;
+    std::mutex   mutex_;
+    Timer_wheel  wheel_;
+};
+
+//子进程退出的结果, pid<0表示启动失败
+struct Child_Exit {
+    int pid;
+    int status;
+};
+
+//启动子进程并等待它退出. Manager为Process_Manager(模板参数, 本文件不依赖boost),
+//需要提供 int spawn(work_dir, cmd, void(pid_t, int)回调): 只启动子进程, 不杀也不附加到同名进程;
+//回调执行时不能持有Manager的锁, 线程池已停止时协程会在回调的线程中直接恢复, 可能再次spawn
+template<typename Manager>
+class Child_Exit_Awaiter
+{
+public:
+    Child_Exit_Awaiter(Manager& manager, Thread_Pool& pool, const std::string& work_dir, const std::string& cmd)
+        : manager_(manager), pool_(pool), work_dir_(work_dir), cmd_(cmd)
+    {
+        result_.pid    = -1;
+        result_.status = 0;
+    }
+
+    bool await_ready() const {
+        return false;
+    }
+
+    //回调可能在spawn返回前就在其它线程中执行并恢复协程, 因此启动成功后不能再访问成员.
+    //回调只生效一次, 协程不会被恢复两次
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        Child_Exit*  result = &result_;
+        Thread_Pool* pool   = &pool_;
+        std::shared_ptr<std::atomic<bool> > resumed = std::make_shared<std::atomic<bool> >(false);
+        int pid = manager_.spawn(work_dir_, cmd_, [result, pool, h, resumed](pid_t pid, int status) {
+            if (resumed->exchange(true)) {
+                return;
+            }
+            result->pid    = pid;
+            result->status = status;
+            resume_on(*pool, h);
+        });
+        if (pid < 0) {
+            result_.pid = pid;
+            return false;
+        }
+        return true;
+    }
+
+    Child_Exit await_resume() const {
+        return result_;
+    }
+
+private:
+    Manager&     manager_;
+    Thread_Pool& pool_;
+    std::string  work_dir_;
+    std::string  cmd_;
+    Child_Exit   result_;
+};
+
+//co_await wait_child_exit(*Process_Manager::instance(), pool, work_dir, cmd);
+template<typename Manager>
+Child_Exit_Awaiter<Manager> wait_child_exit(Manager& manager, Thread_Pool& pool,
+                                            const std::string& work_dir, const std::string& cmd)
+{
+    return Child_Exit_Awaiter<Manager>(manager, pool, work_dir, cmd);
+}
+
+#endif //__cpp_impl_coroutine
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef _THREAD_POOL_GRAPH_H_
+#define _THREAD_POOL_GRAPH_H_
+
+//基于Thread_Pool的任务依赖图(DAG)
+//  一个节点的所有前驱都完成后, 该节点才被调度; 前驱完成时由它把就绪的后继放进线程池,
+//  worker不会阻塞在future::get()上等待其它任务.
+//  图建好后可以反复run, 不需要重建.
+//用法:
+//  Task_Graph g;
+//  auto parse   = g.add_node([&]{ ... });
+//  auto decrypt = g.add_node([&]{ ... });
+//  auto unzip   = g.add_node([&]{ ... });
+//  g.precede(parse, decrypt);
+//  g.precede(decrypt, unzip);
+//  g.run(pool).get();      //或 g.run(pool, [](std::exception_ptr e){ ... }); 完全异步
+//注意:
+//  1. 同一个图同一时刻只能有一次run在执行, run期间不能修改图, 图对象要活到run结束
+//  2. 某个节点抛出异常后, 尚未执行的节点不再执行, 第一个异常通过future/回调返回
+
+#include "thread_pool.h"
+#include <exception>
+
+class Task_Graph
+{
+public:
+    typedef size_t Node;
+    typedef std::function<void(std::exception_ptr)> Done_Callback;
+
+    Task_Graph() : pending_(0), running_(false), failed_(false), pool_(nullptr), checked_(false), acyclic_(false) {}
+
+    Task_Graph(const Task_Graph&) = delete;
+    Task_Graph& operator=(const Task_Graph&) = delete;
+
+    //添加一个节点, 返回节点id
+    Node add_node(std::function<void()> fn)
+    {
+        nodes_.emplace_back(new Node_Data(std::move(fn)));
+        checked_ = false;
+        return nodes_.size() - 1;
+    }
+
+    //添加一条边: from完成后才能执行to
+    void precede(Node from, Node to)
+    {
+        nodes_[from]->successors.push_back(to);
+        nodes_[to]->predecessors += 1;
+        checked_ = false;
+    }
+
+    size_t node_count() const {
+        return nodes_.size();
+    }
+
+    //图是否无环
+    bool is_acyclic()
+    {
+        if (!checked_) {
+            acyclic_ = check_acyclic();
+            checked_ = true;
+        }
+        return acyclic_;
+    }
+
+    //异步执行整个图, 全部节点完成(或出错)后在最后完成的那个线程上调用done.
+    //图有环或正在执行时返回false
+    bool run(Thread_Pool& pool, Done_Callback done)
+    {
+        if (running_.exchange(true)) {
+            return false;
+        }
+        if (!is_acyclic()) {
+            running_ = false;
+            return false;
+        }
+
+        pool_  = &pool;
+        done_  = std::move(done);
+        error_ = nullptr;
+        failed_ = false;
+
+        if (nodes_.empty()) {
+            finish();
+            return true;
+        }
+
+        for (size_t i = 0; i < nodes_.size(); ++i) {
+            nodes_[i]->remaining = nodes_[i]->predecessors;
+        }
+        pending_ = nodes_.size();
+
+        //先统计根节点再提交, 避免提交后节点被执行、修改了remaining
+        std::vector<Node> roots;
+        for (size_t i = 0; i < nodes_.size(); ++i) {
+            if (nodes_[i]->predecessors == 0) {
+                roots.push_back(i);
+            }
+        }
+        for (size_t i = 0; i < roots.size(); ++i) {
+            schedule(roots[i]);
+        }
+        return true;
+    }
+
+    //异步执行整个图, 通过future等待结果. 图有环或正在执行时返回无效的future(valid()为false)
+    std::future<void> run(Thread_Pool& pool)
+    {
+        std::shared_ptr< std::promise<void> > p = std::make_shared< std::promise<void> >();
+        std::future<void> f = p->get_future();
+
+        bool ok = run(pool, [p](std::exception_ptr e) {
+            if (e) {
+                p->set_exception(e);
+            } else {
+                p->set_value();
+            }
+        });
+        return ok ? std::move(f) : std::future<void>();
+    }
+
+private:
+    struct Node_Data {
+        std::function<void()> fn;
+        std::vector<Node>     successors;
+        int                   predecessors;
+        std::atomic<int>      remaining;    //本次执行还未完成的前驱数
+
+        explicit Node_Data(std::function<void()>&& f)
+            : fn(std::move(f)), predecessors(0), remaining(0)
+        {}
+    };
+
+    void schedule(Node n)
+    {
+        if (!pool_->post([this, n]() { this->execute(n); })) {
+            execute(n);     //线程池已停止, 在当前线程执行, 保证图能结束
+        }
+    }
+
+    void execute(Node n)
+    {
+        //就绪的第一个后继直接在当前线程接着执行, 少一次入队出队
+        while (true) {
+            Node_Data& node = *nodes_[n];
+            if (!failed_) {
+                try {
+                    node.fn();
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(error_mutex_);
+                    if (!error_) {
+                        error_ = std::current_exception();
+                    }
+                    failed_ = true;
+                }
+            }
+
+            bool has_next = false;
+            Node next = 0;
+            for (size_t i = 0; i < node.successors.size(); ++i) {
+                Node s = node.successors[i];
+                if (--nodes_[s]->remaining == 0) {
+                    if (!has_next) {
+                        next = s;
+                        has_next = true;
+                    } else {
+                        schedule(s);
+                    }
+                }
+            }
+
+            if (--pending_ == 0) {
+                finish();
+                return;
+            }
+            if (!has_next) {
+                return;
+            }
+            n = next;
+        }
+    }
+
+    void finish()
+    {
+        Done_Callback done;
+        done.swap(done_);
+        std::exception_ptr e = error_;
+        running_ = false;   //之后图可以再次run, 因此不能再访问成员
+        if (done) {
+            done(e);
+        }
+    }
+
+    //Kahn算法检查是否有环
+    bool check_acyclic() const
+    {
+        std::vector<int> in(nodes_.size());
+        std::vector<Node> ready;
+        for (size_t i = 0; i < nodes_.size(); ++i) {
+            in[i] = nodes_[i]->predecessors;
+            if (in[i] == 0) {
+                ready.push_back(i);
+            }
+        }
+
+        size_t visited = 0;
+        while (!ready.empty()) {
+            Node n = ready.back();
+            ready.pop_back();
+            ++visited;
+            const std::vector<Node>& succ = nodes_[n]->successors;
+            for (size_t i = 0; i < succ.size(); ++i) {
+                if (--in[succ[i]] == 0) {
+                    ready.push_back(succ[i]);
+                }
+            }
+        }
+        return visited == nodes_.size();
+    }
+
+private:
+    std::vector< std::unique_ptr<Node_Data> > nodes_;
+    std::atomic<size_t> pending_;       //本次执行还未完成的节点数
+    std::atomic<bool>   running_;
+    std::atomic<bool>   failed_;
+    std::mutex          error_mutex_;
+    std::exception_ptr  error_;
+    Done_Callback       done_;
+    Thread_Pool*        pool_;
+    bool                checked_;
+    bool                acyclic_;
+};
+
+#endif
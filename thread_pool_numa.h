@@ -0,0 +1,220 @@
+#ifndef _THREAD_POOL_NUMA_H_
+#define _THREAD_POOL_NUMA_H_
+
+//按NUMA节点划分的线程池: 每个节点一个Thread_Pool, worker绑定在该节点的cpu上,
+//任务可以指定在哪个节点执行, 让数据和计算在同一个节点(同一块内存、同一组cache).
+//拓扑从linux的sysfs读取(/sys/devices/system/node/nodeN/cpulist), 不依赖libnuma;
+//读取失败或非linux平台时认为只有一个节点, 包含所有cpu.
+//用法:
+//  Numa_Thread_Pool pool;                          //每个节点的线程数 = 该节点的cpu数
+//  pool.post_on(1, [&]{ ... });                    //在节点1上执行
+//  auto f = pool.enqueue([](int x){ return x; }, 1); //在调用线程所在的节点执行
+//  Thread_Pool& p0 = pool.node(0);                 //直接使用某个节点的线程池
+
+#include "thread_pool.h"
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+#ifdef __linux__
+#   include <dirent.h>
+#   include <sched.h>
+#endif
+
+//cpu拓扑: 各NUMA节点有哪些cpu
+struct Cpu_Topology
+{
+    std::vector< std::vector<int> > node_cpus;  //节点 -> cpu列表
+    std::vector<int>                cpu_node;   //cpu  -> 节点
+
+    //只读取一次
+    static const Cpu_Topology& instance()
+    {
+        static Cpu_Topology topo = discover();
+        return topo;
+    }
+
+    size_t node_count() const {
+        return node_cpus.size();
+    }
+
+    //cpu所在的节点, 未知的cpu返回0
+    int node_of_cpu(int cpu) const {
+        return (cpu >= 0 && cpu < (int)cpu_node.size()) ? cpu_node[cpu] : 0;
+    }
+
+    //当前线程正在哪个节点上运行
+    int current_node() const
+    {
+#ifdef __linux__
+        return node_of_cpu(sched_getcpu());
+#else
+        return 0;
+#endif
+    }
+
+    //解析linux的cpulist格式, 如: "0-3,8-11,16"
+    static bool parse_cpu_list(const char* s, std::vector<int>& cpus)
+    {
+        cpus.clear();
+        while (*s) {
+            char* end;
+            long first = strtol(s, &end, 10);
+            if (end == s) {
+                break;
+            }
+            long last = first;
+            s = end;
+            if (*s == '-') {
+                ++s;
+                last = strtol(s, &end, 10);
+                if (end == s) {
+                    return false;
+                }
+                s = end;
+            }
+            for (long c = first; c <= last; ++c) {
+                cpus.push_back(static_cast<int>(c));
+            }
+            while (*s == ',' || *s == ' ' || *s == '\n') {
+                ++s;
+            }
+        }
+        return !cpus.empty();
+    }
+
+    static Cpu_Topology discover()
+    {
+        Cpu_Topology topo;
+
+#ifdef __linux__
+        std::vector<int> ids;
+        DIR* dir = opendir("/sys/devices/system/node");
+        if (dir) {
+            struct dirent* e;
+            while ((e = readdir(dir)) != NULL) {
+                int id;
+                char tail;
+                if (sscanf(e->d_name, "node%d%c", &id, &tail) == 1) {
+                    ids.push_back(id);
+                }
+            }
+            closedir(dir);
+        }
+        std::sort(ids.begin(), ids.end());
+
+        for (size_t i = 0; i < ids.size(); ++i) {
+            char path[128];
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", ids[i]);
+            FILE* fp = fopen(path, "r");
+            if (!fp) {
+                continue;
+            }
+            char buf[1024] = {0};
+            bool ok = fgets(buf, sizeof(buf), fp) != NULL;
+            fclose(fp);
+
+            std::vector<int> cpus;
+            if (ok && parse_cpu_list(buf, cpus)) {  //没有cpu的节点(纯内存节点)跳过
+                topo.node_cpus.push_back(cpus);
+            }
+        }
+#endif
+
+        if (topo.node_cpus.empty()) {
+            std::vector<int> cpus;
+            unsigned n = Thread_Pool::cpu_thread_count();
+            for (unsigned i = 0; i < (n ? n : 1); ++i) {
+                cpus.push_back(static_cast<int>(i));
+            }
+            topo.node_cpus.push_back(cpus);
+        }
+
+        for (size_t n = 0; n < topo.node_cpus.size(); ++n) {
+            const std::vector<int>& cpus = topo.node_cpus[n];
+            for (size_t i = 0; i < cpus.size(); ++i) {
+                if (cpus[i] >= (int)topo.cpu_node.size()) {
+                    topo.cpu_node.resize(cpus[i] + 1, 0);
+                }
+                topo.cpu_node[cpus[i]] = static_cast<int>(n);
+            }
+        }
+        return topo;
+    }
+};
+
+class Numa_Thread_Pool
+{
+public:
+    //threads_per_node为0时每个节点的线程数等于该节点的cpu数.
+    //pin_per_cpu为true时每个worker绑定到一个cpu, 否则worker可在本节点的任一cpu上运行
+    explicit Numa_Thread_Pool(size_t threads_per_node = 0,
+                              bool stop_asap = true,
+                              Thread_Pool::Schedule_Mode mode = Thread_Pool::SHARED_QUEUE,
+                              bool pin_per_cpu = false)
+        : next_node_(0)
+    {
+        const Cpu_Topology& topo = Cpu_Topology::instance();
+        for (size_t n = 0; n < topo.node_count(); ++n) {
+            const std::vector<int>& cpus = topo.node_cpus[n];
+            size_t threads = threads_per_node ? threads_per_node : cpus.size();
+            pools_.emplace_back(new Thread_Pool(threads, stop_asap, mode));
+            pools_.back()->set_cpu_affinity(cpus, pin_per_cpu);
+        }
+    }
+
+    size_t node_count() const {
+        return pools_.size();
+    }
+
+    //某个节点的线程池
+    Thread_Pool& node(size_t n) {
+        return *pools_[n % pools_.size()];
+    }
+
+    //调用线程当前所在的节点
+    size_t current_node() const {
+        return static_cast<size_t>(Cpu_Topology::instance().current_node()) % pools_.size();
+    }
+
+    //在指定节点上执行
+    template<class F, class... Args>
+    auto enqueue_on(size_t n, F&& f, Args&&... args)->std::future<decltype(f(args...))> {
+        return node(n).enqueue(std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    template<class F>
+    bool post_on(size_t n, F&& f) {
+        return node(n).post(std::forward<F>(f));
+    }
+
+    //在调用线程所在的节点上执行
+    template<class F, class... Args>
+    auto enqueue(F&& f, Args&&... args)->std::future<decltype(f(args...))> {
+        return enqueue_on(current_node(), std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    template<class F>
+    bool post(F&& f) {
+        return post_on(current_node(), std::forward<F>(f));
+    }
+
+    //各节点轮流执行, 用于和数据位置无关的任务
+    template<class F>
+    bool post_round_robin(F&& f) {
+        return post_on(next_node_++, std::forward<F>(f));
+    }
+
+    void stop() {
+        for (size_t i = 0; i < pools_.size(); ++i) {
+            pools_[i]->stop();
+        }
+    }
+
+private:
+    std::vector< std::unique_ptr<Thread_Pool> > pools_;
+    std::atomic<size_t> next_node_;
+};
+
+#endif
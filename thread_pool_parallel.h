@@ -0,0 +1,189 @@
+#ifndef _THREAD_POOL_PARALLEL_H_
+#define _THREAD_POOL_PARALLEL_H_
+
+//基于Thread_Pool的 parallel_for / parallel_reduce
+//  1. 按块(chunk)分配任务, 不再是每个元素一个enqueue和一个future
+//  2. 自适应分块: 每次取 max(grain, 剩余数量 / (2 * 参与线程数)) 个, 开始时块大, 快结束时块小, 负载更均衡
+//  3. 调用线程也参与计算, 而不是阻塞在future上; 在worker线程中嵌套调用也不会死锁
+//用法:
+//  parallel_for(pool, 0, n, 64, [&](int i) { out[i] = f(in[i]); });
+//  long sum = parallel_reduce(pool, 0, n, 1024, 0L,
+//                  [&](int b, int e, long acc) { for (; b < e; ++b) acc += v[b]; return acc; },
+//                  [](long a, long b) { return a + b; });
+
+#include "thread_pool.h"
+#include <algorithm>
+#include <exception>
+
+namespace parallel_detail {
+
+template<typename Index>
+struct Range_State {
+    std::atomic<Index>      next;
+    const Index             end;
+    const Index             grain;
+    const Index             participants;
+    std::atomic<int>        running;    //正在执行的helper数
+    std::mutex              mutex;
+    std::condition_variable cond;
+    std::exception_ptr      error;
+
+    Range_State(Index b, Index e, Index g, Index p)
+        : next(b), end(e), grain(g), participants(p), running(0)
+    {}
+
+    //取下一块[b, e), 取完返回false
+    bool grab(Index& b, Index& e)
+    {
+        Index cur = next.load();
+        for (;;) {
+            if (cur >= end) {
+                return false;
+            }
+            Index n = (end - cur) / (2 * participants);
+            n = (std::max)(n, grain);
+            Index stop = (end - cur > n) ? cur + n : end;
+            if (next.compare_exchange_weak(cur, stop)) {
+                b = cur;
+                e = stop;
+                return true;
+            }
+        }
+    }
+
+    void set_error(std::exception_ptr e)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) {
+            error = e;
+        }
+        next = end;     //出错后不再分配新的块
+    }
+
+    void leave()
+    {
+        if (--running == 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            cond.notify_all();
+        }
+    }
+
+    //调用线程做完自己的部分后, 等待其它已经开始的helper结束.
+    //还没开始执行的helper之后再开始时已取不到块, 不会再访问调用者的fn
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this]{ return this->running == 0; });
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+//除调用线程外, 还需要向线程池提交几个helper
+template<typename Index>
+inline Index helper_count(const Thread_Pool& pool, Index begin, Index end, Index grain)
+{
+    Index chunks = (end - begin + grain - 1) / grain;
+    Index threads = static_cast<Index>(pool.thread_count());
+    return (std::min)(threads, chunks - 1);
+}
+
+} //namespace parallel_detail
+
+//对[begin, end)中的每个i调用fn(i), 返回时所有调用都已完成. fn抛出的第一个异常会在调用线程重新抛出
+template<typename Index, typename Fn>
+void parallel_for(Thread_Pool& pool, Index begin, Index end, Index grain, Fn&& fn)
+{
+    typedef parallel_detail::Range_State<Index> State;
+
+    if (begin >= end) {
+        return;
+    }
+    if (grain < 1) {
+        grain = 1;
+    }
+
+    Index helpers = parallel_detail::helper_count(pool, begin, end, grain);
+    std::shared_ptr<State> state = std::make_shared<State>(begin, end, grain, helpers + 1);
+
+    auto body = [state, &fn]() {
+        Index b, e;
+        try {
+            while (state->grab(b, e)) {
+                for (; b < e; ++b) {
+                    fn(b);
+                }
+            }
+        } catch (...) {
+            state->set_error(std::current_exception());
+        }
+    };
+
+    for (Index i = 0; i < helpers; ++i) {
+        pool.post([state, body]() {
+            ++state->running;
+            body();
+            state->leave();
+        });
+    }
+
+    ++state->running;
+    body();
+    state->leave();
+    state->wait();
+}
+
+//把[begin, end)分块, 每个参与线程用 range_fn(b, e, acc) 累加自己分到的块,
+//最后用 combine(a, b) 合并各线程的结果. combine需满足结合律和交换律
+template<typename Index, typename T, typename Range_Fn, typename Combine>
+T parallel_reduce(Thread_Pool& pool, Index begin, Index end, Index grain, T identity,
+                  Range_Fn&& range_fn, Combine&& combine)
+{
+    typedef parallel_detail::Range_State<Index> State;
+
+    if (begin >= end) {
+        return identity;
+    }
+    if (grain < 1) {
+        grain = 1;
+    }
+
+    Index helpers = parallel_detail::helper_count(pool, begin, end, grain);
+    std::shared_ptr<State> state = std::make_shared<State>(begin, end, grain, helpers + 1);
+    T result = identity;
+
+    auto body = [state, &range_fn, &combine, &result, identity]() {
+        Index b, e;
+        bool got = false;
+        T acc = identity;
+        try {
+            while (state->grab(b, e)) {
+                acc = range_fn(b, e, std::move(acc));
+                got = true;
+            }
+            if (got) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                result = combine(std::move(result), std::move(acc));
+            }
+        } catch (...) {
+            state->set_error(std::current_exception());
+        }
+    };
+
+    for (Index i = 0; i < helpers; ++i) {
+        pool.post([state, body]() {
+            ++state->running;
+            body();
+            state->leave();
+        });
+    }
+
+    ++state->running;
+    body();
+    state->leave();
+    state->wait();
+    return result;
+}
+
+#endif
@@ -0,0 +1,242 @@
+#ifndef _TIMER_SERVICE_H_
+#define _TIMER_SERVICE_H_
+
+//用timerfd + epoll驱动的Timer_wheel (仅linux)
+//  1. 时间取自CLOCK_MONOTONIC, 不受修改系统时间、NTP跳变的影响
+//  2. timerfd总是设置为时间轮中下一个需要处理的时间, 没有定时器时不设置, 线程在epoll_wait中休眠, 不需要每毫秒醒来一次
+//  3. 可以直接用run()作为事件循环, 也可以把fd()加入自己的epoll, 可读时调用handle_events()
+//用法:
+//  Timer_Service timers;
+//  timers.schedule_after(1000, 0, [] { ... });    //1秒后
+//  timers.run();                                   //在其它线程中调用timers.stop()退出
+//注意:
+//  除stop()外, 所有函数(包括回调)都要在同一个线程中调用
+
+#ifdef __linux__
+
+#include "timer_wheel.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <atomic>
+
+class Timer_Service
+{
+public:
+    Timer_Service()
+        : start_(now())
+        , wheel_(&start_)
+        , timer_fd_(-1)
+        , epoll_fd_(-1)
+        , wakeup_fd_(-1)
+        , armed_(false)
+        , armed_ms_(0)
+        , dispatching_(false)
+        , stopped_(false)
+    {
+        timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer_fd_ >= 0 && open_epoll() != 0) {
+            close(timer_fd_);
+            timer_fd_ = -1;
+        }
+    }
+
+    ~Timer_Service()
+    {
+        if (timer_fd_ >= 0) {
+            close(timer_fd_);
+        }
+        if (epoll_fd_ >= 0) {
+            close(epoll_fd_);
+        }
+        if (wakeup_fd_ >= 0) {
+            close(wakeup_fd_);
+        }
+    }
+
+    //timerfd及epoll创建成功
+    bool valid() const {
+        return timer_fd_ >= 0;
+    }
+
+    //加入自己的epoll(EPOLLIN), 可读时调用handle_events()
+    int fd() const {
+        return timer_fd_;
+    }
+
+    //CLOCK_MONOTONIC的当前时间
+    static void now(timeval* tv)
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        tv->tv_sec  = ts.tv_sec;
+        tv->tv_usec = ts.tv_nsec / 1000;
+    }
+
+    static timeval now()
+    {
+        timeval tv;
+        now(&tv);
+        return tv;
+    }
+
+    //delay_ms毫秒后触发, interval同Timer_wheel::schedule. 返回NULL为失败
+    template<typename F, typename ...Args>
+    Timer_handle schedule_after(unsigned long delay_ms, unsigned long interval, F&& f, Args&& ...args)
+    {
+        timeval tv;
+        now(&tv);
+        unsigned long usec = tv.tv_usec + (delay_ms % 1000) * 1000;
+        tv.tv_sec  += delay_ms / 1000 + usec / 1000000;
+        tv.tv_usec  = usec % 1000000;
+        return schedule_at(&tv, interval, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    //在CLOCK_MONOTONIC的expire_tv时刻触发
+    template<typename F, typename ...Args>
+    Timer_handle schedule_at(const timeval* expire_tv, unsigned long interval, F&& f, Args&& ...args)
+    {
+        Timer_handle h = wheel_.schedule(expire_tv, interval, std::forward<F>(f), std::forward<Args>(args)...);
+        if (h && !dispatching_) {
+            unsigned long ms = expire_tv->tv_sec * 1000 + expire_tv->tv_usec / 1000;
+            if (!armed_ || (long)(ms - armed_ms_) < 0) {
+                rearm();    //比已设置的时间早才需要重新设置timerfd
+            }
+        }
+        return h;
+    }
+
+    //取消定时器. 不重新设置timerfd, 最多多醒来一次
+    int cancel_timer(Timer_handle h) {
+        return wheel_.cancel_timer(h);
+    }
+
+    //timerfd可读时调用: 触发到期的定时器, 然后把timerfd设置为下一个定时器的时间
+    int handle_events()
+    {
+        uint64_t expirations;
+        while (read(timer_fd_, &expirations, sizeof(expirations)) < 0 && errno == EINTR) {
+        }
+
+        timeval tv;
+        now(&tv);
+        dispatching_ = true;
+        int ret = wheel_.expire(&tv);
+        dispatching_ = false;
+        rearm();
+        return ret;
+    }
+
+    //事件循环, 直到stop(). 成功返回0, 失败返回-1
+    int run()
+    {
+        if (timer_fd_ < 0) {
+            return -1;
+        }
+
+        rearm();
+        while (!stopped_) {
+            epoll_event events[2];
+            int n = epoll_wait(epoll_fd_, events, 2, -1);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+            for (int i = 0; i < n; ++i) {
+                if (events[i].data.fd == timer_fd_) {
+                    handle_events();
+                } else {
+                    uint64_t v;
+                    while (read(wakeup_fd_, &v, sizeof(v)) < 0 && errno == EINTR) {
+                    }
+                }
+            }
+        }
+        return 0;
+    }
+
+    //让run()返回, 可以在任意线程调用
+    void stop()
+    {
+        stopped_ = true;
+        if (wakeup_fd_ >= 0) {
+            uint64_t v = 1;
+            while (write(wakeup_fd_, &v, sizeof(v)) < 0 && errno == EINTR) {
+            }
+        }
+    }
+
+private:
+    int open_epoll()
+    {
+        epoll_fd_  = epoll_create1(EPOLL_CLOEXEC);
+        wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epoll_fd_ < 0 || wakeup_fd_ < 0) {
+            return -1;
+        }
+
+        epoll_event ev;
+        ev.events  = EPOLLIN;
+        ev.data.fd = timer_fd_;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &ev) != 0) {
+            return -1;
+        }
+        ev.data.fd = wakeup_fd_;
+        return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &ev);
+    }
+
+    //把timerfd设置为时间轮中下一个需要处理的时间, 没有定时器时关闭
+    void rearm()
+    {
+        timeval tv;
+        now(&tv);
+        long timeout = wheel_.next_timeout(&tv);
+
+        itimerspec its;
+        its.it_interval.tv_sec  = 0;
+        its.it_interval.tv_nsec = 0;
+        if (timeout < 0) {
+            its.it_value.tv_sec  = 0;
+            its.it_value.tv_nsec = 0;
+            armed_ = false;
+        } else {
+            //时间轮以毫秒为单位, 到达那一毫秒的开始即过期. it_value为0表示关闭, 已到期时设为1纳秒
+            unsigned long now_ms = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+            armed_ms_ = now_ms + timeout;
+            long nsec = timeout * 1000000L - (tv.tv_usec % 1000) * 1000L;
+            if (nsec <= 0) {
+                nsec = 1;
+            }
+            its.it_value.tv_sec  = nsec / 1000000000L;
+            its.it_value.tv_nsec = nsec % 1000000000L;
+            armed_ = true;
+        }
+        timerfd_settime(timer_fd_, 0, &its, NULL);
+    }
+
+private:
+    Timer_Service(const Timer_Service&);
+    Timer_Service& operator=(const Timer_Service&);
+
+private:
+    timeval           start_;           //时间轮的起始时间, 必须在wheel_之前初始化
+    Timer_wheel       wheel_;
+    int               timer_fd_;
+    int               epoll_fd_;
+    int               wakeup_fd_;
+    bool              armed_;
+    unsigned long     armed_ms_;        //timerfd设置的时间(毫秒)
+    bool              dispatching_;     //正在handle_events中, 回调里新增的定时器在结束后统一rearm
+    std::atomic<bool> stopped_;
+};
+
+#endif //__linux__
+
+#endif
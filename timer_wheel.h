@@ -1,19 +1,23 @@
 #ifndef _TIMER_WHEEL_H_
 #define _TIMER_WHEEL_H_
 
-#include <list>
+#include <vector>
+#include <memory>
 #include <functional>
+#include <string.h>
+#include "small_function.h"
+#ifdef _MSC_VER
+#   include <intrin.h>
+#endif
 
-struct timeval;
-
-//-------------------------------以下宏及结构体请参考linux内核-------------------------------
-#define TVN_BITS 6 //(CONFIG_BASE_SMALL ? 4 : 6)
-#define TVR_BITS 8 //(CONFIG_BASE_SMALL ? 6 : 8)
-#define TVN_SIZE (1 << TVN_BITS)
-#define TVR_SIZE (1 << TVR_BITS)
-#define TVN_MASK (TVN_SIZE - 1)
-#define TVR_MASK (TVR_SIZE - 1)
+//for::   struct timeval
+#ifdef WIN32
+#   include <winsock2.h>
+#else
+#   include <sys/time.h>
+#endif
 
+//-------------------------------以下结构体请参考linux内核-------------------------------
 /**
  * Simple doubly linked list implementation.
  *
@@ -27,36 +31,47 @@ struct list_head {
 	struct list_head *next, *prev;
 };
 
-struct tvec {
-    struct list_head vec[TVN_SIZE];
-};
-
-struct tvec_root {
-    struct list_head vec[TVR_SIZE];
-};
+//只能移动, 不超过48字节的可调用对象直接存放在timer_list中, 不分配内存
+typedef Small_Function<void()> Callback_Function;
 
-typedef std::function<void()> Callback_Function;
+//时间轮内部的回调, 参数为合并掉的周期数(见TIMER_COALESCE), 其它定时器为0
+typedef Small_Function<void(unsigned long)> Timer_Callback;
 
 struct timer_list {
-    struct list_head entry;
+    enum {
+        TIMER_COALESCE = 1,     //周期性定时器落后多个周期时只回调一次, 参数为少回调的次数
+    };
+
+    struct list_head entry;     //必须是第一个成员, 见timer_wheel_detail::timer_of
+    int wheel_slot;             //所在的槽: level * ROOT_SIZE + index, level为0~4(tv1~tv5)
     unsigned long expires;
-    unsigned long interval;     //重复周期，0-一次性定时器，其它值为周期性定时器
-    Callback_Function fn;       //回调函数. 采用c++ 11的function导致很多编译警告, raw function ptr就没有警告
+    unsigned long interval;     //重复周期(tick)，0-一次性定时器，其它值为周期性定时器
+    unsigned int gen;           //每回收一次加1, 用于判断回调执行期间定时器是否被取消
+    unsigned int flags;
+    Timer_Callback fn;          //回调函数
+    std::shared_ptr<Timer_Callback> shared_fn;  //周期性定时器第一次批量触发时把fn移到这里, 之后每次触发共享它
 };
+//-------------------------------以上代码参考linux内核-------------------------------
 
-struct tvec_base {
-    unsigned long timer_expire;
-    struct tvec_root tv1;
-    struct tvec tv2;
-    struct tvec tv3;
-    struct tvec tv4;
-    struct tvec tv5;
+//批量触发(expire的batch参数)时收集的一个回调
+struct Expired_Timer {
+    Timer_Callback fn;
+    unsigned long missed;
+
+    void operator()() {
+        fn(missed);
+    }
 };
-//-------------------------------以上代码参考linux内核-------------------------------
+typedef std::vector<Expired_Timer> Timer_Batch;
 
+//timer_list的slab分配器: 每次申请SLAB_SIZE个节点, 空闲节点通过entry.next串成链表,
+//回收的节点不还给系统, 稳定状态下alloc/free不分配内存. 所有内存在析构时释放
 class Free_Timer_List
 {
 public:
+    enum { SLAB_SIZE = 256 };
+
+    Free_Timer_List() : free_head_(NULL) {}
     ~Free_Timer_List();
 
 public:
@@ -64,73 +79,785 @@ public:
     void free(struct timer_list*);
 
 private:
-    std::list<struct timer_list*> free_list_;
+    Free_Timer_List(const Free_Timer_List&);
+    Free_Timer_List& operator=(const Free_Timer_List&);
+
+private:
+    std::vector<struct timer_list*> slabs_;
+    struct timer_list* free_head_;
 };
 
+namespace timer_wheel_detail {
+
+///////////////////////////以下代码改自linux内核//////////////////////////////////////////
+/*
+ * These are non-NULL pointers that will result in page faults
+ * under normal circumstances, used to verify that nobody uses
+ * non-initialized list entries.
+ */
+#define TIMER_LIST_POISON2  ((struct list_head *) 0x00200200)
+
+inline void init_list_head(struct list_head *list)
+{
+    list->next = list;
+    list->prev = list;
+}
+
+/*
+ * Insert a new entry between two known consecutive entries.
+ *
+ * This is only for internal list manipulation where we know
+ * the prev/next entries already!
+ */
+inline void __list_add(struct list_head *new1,
+                  struct list_head *prev,
+                  struct list_head *next)
+{
+    next->prev = new1;
+    new1->next = next;
+    new1->prev = prev;
+    prev->next = new1;
+}
+
+/**
+ * list_add_tail - add a new entry
+ * @new: new entry to be added
+ * @head: list head to add it before
+ *
+ * Insert a new entry before the specified head.
+ * This is useful for implementing queues.
+ */
+inline void list_add_tail(struct list_head *new1, struct list_head *head)
+{
+    __list_add(new1, head->prev, head);
+}
+
+/**
+* list_replace - replace old entry by new one
+* @old : the element to be replaced
+* @new : the new element to insert
+*
+* If @old was empty, it will be overwritten.
+*/
+inline void list_replace(struct list_head *old, struct list_head *new1)
+{
+     new1->next = old->next;
+     new1->next->prev = new1;
+     new1->prev = old->prev;
+     new1->prev->next = new1;
+}
+
+inline void list_replace_init(struct list_head *old, struct list_head *new1)
+{
+    list_replace(old, new1);
+    init_list_head(old);
+}
+
+/*
+ * Delete a list entry by making the prev/next entries
+ * point to each other.
+ *
+ * This is only for internal list manipulation where we know
+ * the prev/next entries already!
+ */
+inline void __list_del(struct list_head * prev, struct list_head * next)
+{
+    next->prev = prev;
+    prev->next = next;
+}
+
+/**
+ * list_empty - tests whether a list is empty
+ * @head: the list to test.
+ */
+inline int list_empty(const struct list_head *head)
+{
+    return head->next == head;
+}
+
+///////////////////////////////以上代码抄自linux内核///////////////////////////////////////////
+
+inline bool time_after(unsigned long a, unsigned long b) {
+    return (long)(b) - (long)(a) < 0;
+}
+
+inline bool time_before(unsigned long a, unsigned long b) {
+    return time_after(b, a);
+}
+
+inline bool time_after_eq(unsigned long a, unsigned long b) {
+    return (long)(a) - (long)(b) >= 0;
+}
+
+//代替list_entry(ptr, struct timer_list, entry). entry是第一个成员, timer_list不是标准布局, 不能用offsetof
+inline struct timer_list* timer_of(struct list_head* ptr) {
+    return reinterpret_cast<struct timer_list*>(ptr);
+}
+
+/**
+ * timer_pending - is a timer pending?
+ * @timer: the timer in question
+ *
+ * return value: 1 if the timer is pending, 0 if not.
+ */
+inline int timer_pending(const struct timer_list * timer)
+{
+    return timer->entry.next != NULL;
+}
+
+//m的最低置位的位置, m不能为0
+inline int ctz64(unsigned long long m)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, m);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(m);
+#endif
+}
+
+/*
+ * 在bits位的位图中从from开始(到末尾后回到开头)查找第一个置位的位,
+ * 返回它与from的距离, 没有置位的返回-1. bits为2的幂, 小于64时只用map[0]
+ */
+inline int find_next_bit(const unsigned long long* map, int bits, int from)
+{
+    if (bits < 64) {
+        unsigned long long m = map[0];
+        if (m >> from) {
+            return ctz64(m >> from);
+        }
+        m &= (1ULL << from) - 1;
+        return m ? ctz64(m) + bits - from : -1;
+    }
+
+    int words = bits / 64;
+    int shift = from % 64;
+
+    for (int n = 0; n <= words; ++n) {
+        int w = (from / 64 + n) % words;
+        unsigned long long m = map[w];
+        if (n == 0) {
+            m &= ~0ULL << shift;                        //第一个字只看from及之后的位
+        } else if (n == words) {
+            m &= shift ? ~(~0ULL << shift) : 0;         //绕回来后只看from之前的位
+        }
+        if (m) {
+            int bit = w * 64 + ctz64(m);
+            return (bit - from + bits) % bits;
+        }
+    }
+    return -1;
+}
+
+} //namespace timer_wheel_detail
+
+//时间轮, 结构同linux内核: tv1有2^Root_Bits个槽, tv2~tv5各有2^Level_Bits个槽.
+//  Tick_Us:    一个tick的微秒数, 默认1毫秒. 定时器的精度为1个tick, interval和next_timeout的单位也是tick
+//  Root_Bits:  tv1的位数, 2^Root_Bits个tick内的定时器不需要cascade
+//  Level_Bits: tv2~tv5每级的位数
+//能表示的最长超时为 2^(Root_Bits + 4*Level_Bits) - 1 个tick, 更长的按最长处理. 例如:
+//  Timer_Wheel_Impl<100, 8, 6>:       100微秒一个tick, 用于发送节奏控制
+//  Timer_Wheel_Impl<1000000, 6, 4>:   1秒一个tick, 用于会话超时
+template<unsigned long Tick_Us = 1000, int Root_Bits = 8, int Level_Bits = 6>
 class Timer_Wheel_Impl
 {
 public:
-    Timer_Wheel_Impl();
-    ~Timer_Wheel_Impl();
+    enum {
+        ROOT_BITS  = Root_Bits,
+        LEVEL_BITS = Level_Bits,
+        ROOT_SIZE  = 1 << Root_Bits,
+        LEVEL_SIZE = 1 << Level_Bits,
+        ROOT_MASK  = ROOT_SIZE - 1,
+        LEVEL_MASK = LEVEL_SIZE - 1,
+        ROOT_MAP_WORDS  = (ROOT_SIZE + 63) / 64,
+        LEVEL_MAP_WORDS = (LEVEL_SIZE + 63) / 64,
+    };
+
+    static_assert(Tick_Us > 0, "Tick_Us must be positive");
+    static_assert(Root_Bits > 0 && Level_Bits > 0, "level widths must be positive");
+    static_assert(Root_Bits + 4 * Level_Bits <= 32, "wheel range must fit in 32 bits of ticks");
+
+    Timer_Wheel_Impl()
+    {
+        struct timeval tv;
+
+#ifdef WIN32
+        tv = ACE_OS::gettimeofday();   //待移植到linux
+#else
+        gettimeofday(&tv, NULL);
+#endif
+
+        init(&tv);
+    }
+
+    //以start为起始时间, 之后所有的时间都要和它用同一个时钟(如CLOCK_MONOTONIC)
+    explicit Timer_Wheel_Impl(const timeval* start)
+    {
+        init(start);
+    }
+
+    ~Timer_Wheel_Impl()
+    {
+        //析构函数中释放所有定时器
+        for (int slot = 0; slot < ROOT_SIZE + 4 * LEVEL_SIZE; ++slot) {
+            free_timer_list(slot_head(slot_of(slot)));
+        }
+    }
 
 public:
     struct timer_list* add_timer(
-                                Callback_Function fn,
+                                Timer_Callback fn,
                                 const timeval* expire_tv,
-                                unsigned long interval
-                                );
-    int remove_timer(struct timer_list* timer);
-    int expire(const timeval* tv);
+                                unsigned long interval,
+                                unsigned int flags = 0
+                                )
+    {
+        timer_list* timer = free_list_.alloc();
+
+        if (timer) {
+            timer->fn       = std::move(fn);
+            timer->expires  = to_tick(expire_tv);
+            timer->interval = interval;
+            timer->flags    = flags;
+            internal_add_timer(timer);
+        }
+
+        return timer;
+    }
+
+    int remove_timer(struct timer_list* timer)
+    {
+    /*考虑这种情况：
+      add_timer返回句柄，expire()后timeout了(隐式调用了remove_timer), 此时之前的句柄已无效。
+      如果再调用remove_timer, 这就乱了!
+      外围应该在timeout回调中处理这种情况
+    */
+        if (timer_wheel_detail::timer_pending(timer)) {
+            detach_timer(timer, 1);
+        }
+
+        free_list_.free(timer);
+        return 0;
+    }
+
+    //触发所有过期的定时器. batch不为NULL时不执行回调, 而是按触发顺序追加到batch中
+    int expire(const timeval* tv, Timer_Batch* batch = NULL);
+
+    //距离下一个定时器需要处理还有多少个tick, 事件循环最多可以休眠这么久; 没有定时器返回-1
+    long next_timeout(const timeval* tv)
+    {
+        unsigned long tick;
+        if (!next_timer(&tick)) {
+            return -1;
+        }
+
+        long timeout = (long)(tick - to_tick(tv));
+        return timeout > 0 ? timeout : 0;
+    }
+
+    //timeval对应的tick
+    static unsigned long to_tick(const timeval* tv)
+    {
+        if (1000000 % Tick_Us == 0) {
+            return tv->tv_sec * (1000000 / Tick_Us) + tv->tv_usec / Tick_Us;
+        }
+        return (unsigned long)(((unsigned long long)tv->tv_sec * 1000000 + tv->tv_usec) / Tick_Us);
+    }
 
 protected:
-    int mod_timer(struct timer_list *timer, unsigned long expires);
+    int mod_timer(struct timer_list *timer, unsigned long expires)
+    {
+        /*
+         * This is a common optimization triggered by the
+         * networking code - if the timer is re-modified
+         * to be the same thing then just return:
+         */
+        if (timer_wheel_detail::timer_pending(timer) && timer->expires == expires) {
+            return 1;
+        }
+
+        if (timer_wheel_detail::timer_pending(timer)) {
+            detach_timer(timer, 0);
+        }
+
+        timer->expires = expires;
+        internal_add_timer(timer);
+
+        return 0;
+    }
+
     int internal_add_timer(struct timer_list *timer);
-    void detach_timer(struct timer_list *timer, int clear_pending);
 
-    int cascade(struct tvec *tv, int index);
-    void free_timer_list(struct list_head* head);
+    void detach_timer(struct timer_list *timer, int clear_pending)
+    {
+        struct list_head *entry = &timer->entry;
+
+        timer_wheel_detail::__list_del(entry->prev, entry->next);
+
+        //槽空了. 缓存的next_timer可以不改, 它只是变得偏早, expire时多检查一次
+        if (timer_wheel_detail::list_empty(slot_head(timer->wheel_slot))) {
+            clear_slot_bit(timer->wheel_slot);
+        }
+
+        if (clear_pending) {
+            entry->next = NULL;
+        }
+
+        entry->prev = TIMER_LIST_POISON2;
+    }
+
+    void init(const timeval* start)
+    {
+        m_base.timer_expire = to_tick(start);
+        m_base.next_timer = m_base.timer_expire;
+        m_base.next_timer_valid = 0;
+        memset(m_base.tv1_map, 0, sizeof(m_base.tv1_map));
+        memset(m_base.tvn_map, 0, sizeof(m_base.tvn_map));
+
+        for (int slot = 0; slot < ROOT_SIZE + 4 * LEVEL_SIZE; ++slot) {
+            timer_wheel_detail::init_list_head(slot_head(slot_of(slot)));
+        }
+    }
+
+    int cascade(int level, int index);
+
+    void free_timer_list(struct list_head* head)
+    {
+        while (!timer_wheel_detail::list_empty(head)) {
+            struct timer_list* timer = timer_wheel_detail::timer_of(head->next);
+            detach_timer(timer, 1);
+            free_list_.free(timer);
+        }
+    }
+
+    //槽编号: level * ROOT_SIZE + index
+    static int slot(int level, int index) {
+        return level * ROOT_SIZE + index;
+    }
+
+    static int slot_level(int slot) {
+        return slot / ROOT_SIZE;
+    }
+
+    static int slot_index(int slot) {
+        return slot % ROOT_SIZE;
+    }
+
+    //按顺序编号的第n个槽(tv1的ROOT_SIZE个, 然后是tv2~tv5各LEVEL_SIZE个)
+    static int slot_of(int n) {
+        return n < ROOT_SIZE ? n : slot(1 + (n - ROOT_SIZE) / LEVEL_SIZE, (n - ROOT_SIZE) % LEVEL_SIZE);
+    }
+
+    //第level(>=1)级的一个槽覆盖多少个tick
+    static int level_shift(int level) {
+        return Root_Bits + (level - 1) * Level_Bits;
+    }
+
+    struct list_head* slot_head(int slot)
+    {
+        int level = slot_level(slot);
+        int index = slot_index(slot);
+        return level == 0 ? m_base.tv1 + index : m_base.tvn[level - 1] + index;
+    }
+
+    void set_slot_bit(int slot)
+    {
+        int level = slot_level(slot);
+        int index = slot_index(slot);
+        if (level == 0) {
+            m_base.tv1_map[index / 64] |= 1ULL << (index % 64);
+        } else {
+            m_base.tvn_map[level - 1][index / 64] |= 1ULL << (index % 64);
+        }
+    }
+
+    void clear_slot_bit(int slot)
+    {
+        int level = slot_level(slot);
+        int index = slot_index(slot);
+        if (level == 0) {
+            m_base.tv1_map[index / 64] &= ~(1ULL << (index % 64));
+        } else {
+            m_base.tvn_map[level - 1][index / 64] &= ~(1ULL << (index % 64));
+        }
+    }
+
+    unsigned long slot_tick(int slot) const;
+    int next_timer(unsigned long* tick);
 
 private:
+    struct tvec_base {
+        unsigned long timer_expire;
+        unsigned long next_timer;           //缓存的下一个需要处理的tick(到期或需要cascade), next_timer_valid为0时需重新计算
+        int next_timer_valid;
+        unsigned long long tv1_map[ROOT_MAP_WORDS];     //每一级一个位图, 记录哪些槽非空, 用于跳过空的tick
+        unsigned long long tvn_map[4][LEVEL_MAP_WORDS]; //tv2~tv5
+        struct list_head tv1[ROOT_SIZE];
+        struct list_head tvn[4][LEVEL_SIZE];
+    };
+
     struct tvec_base m_base;
-    Free_Timer_List free_list_;   //用于缓存timer_list;
+    Free_Timer_List free_list_;   //timer_list的分配器
 };
+
+/*
+ * 槽下一次被处理的tick(不早于timer_expire):
+ * tv1的槽在timer_expire的低Root_Bits位等于index时执行;
+ * tv2~tv5的槽在低level_shift位全为0、且上一级的INDEX等于index时cascade到低一级
+ */
+template<unsigned long Tick_Us, int Root_Bits, int Level_Bits>
+unsigned long Timer_Wheel_Impl<Tick_Us, Root_Bits, Level_Bits>::slot_tick(int slot) const
+{
+    int level = slot_level(slot);
+    unsigned long index = slot_index(slot);
+    if (level == 0) {
+        return m_base.timer_expire + ((index - m_base.timer_expire) & ROOT_MASK);
+    }
+
+    unsigned long mask = (1UL << level_shift(level)) - 1;
+    unsigned long base = (m_base.timer_expire + mask) & ~mask;
+    unsigned long cur  = (base >> level_shift(level)) & LEVEL_MASK;
+    return base + (((index - cur) & LEVEL_MASK) << level_shift(level));
+}
+
+/*
+ * 下一个需要处理(有定时器到期, 或有非空的槽需要cascade)的tick, 没有定时器返回0.
+ * 每一级只需在位图中找timer_expire之后的第一个非空槽, 因此与空闲的时长无关
+ */
+template<unsigned long Tick_Us, int Root_Bits, int Level_Bits>
+int Timer_Wheel_Impl<Tick_Us, Root_Bits, Level_Bits>::next_timer(unsigned long* tick)
+{
+    if (!m_base.next_timer_valid) {
+        int found = 0;
+        unsigned long best = 0;     //与timer_expire的距离
+
+        int d = timer_wheel_detail::find_next_bit(m_base.tv1_map, ROOT_SIZE, m_base.timer_expire & ROOT_MASK);
+        if (d >= 0) {
+            best  = d;
+            found = 1;
+        }
+
+        for (int level = 1; level <= 4; ++level) {
+            unsigned long mask = (1UL << level_shift(level)) - 1;
+            unsigned long base = (m_base.timer_expire + mask) & ~mask;
+            int cur = (base >> level_shift(level)) & LEVEL_MASK;
+            d = timer_wheel_detail::find_next_bit(m_base.tvn_map[level - 1], LEVEL_SIZE, cur);
+            if (d < 0) {
+                continue;
+            }
+
+            unsigned long dist = base - m_base.timer_expire + ((unsigned long)d << level_shift(level));
+            if (!found || dist < best) {
+                best  = dist;
+                found = 1;
+            }
+        }
+
+        if (!found) {
+            return 0;
+        }
+        m_base.next_timer = m_base.timer_expire + best;
+        m_base.next_timer_valid = 1;
+    }
+
+    *tick = m_base.next_timer;
+    return 1;
+}
+
+template<unsigned long Tick_Us, int Root_Bits, int Level_Bits>
+int Timer_Wheel_Impl<Tick_Us, Root_Bits, Level_Bits>::internal_add_timer(struct timer_list *timer)
+{
+    unsigned long expires = timer->expires;
+    unsigned long idx = expires - m_base.timer_expire;
+    int s;
+
+    if (idx < ROOT_SIZE) {
+        int i = expires & ROOT_MASK;
+        s = slot(0, i);
+    } else if (idx < 1UL << level_shift(2)) {
+        int i = (expires >> level_shift(1)) & LEVEL_MASK;
+        s = slot(1, i);
+    } else if (idx < 1UL << level_shift(3)) {
+        int i = (expires >> level_shift(2)) & LEVEL_MASK;
+        s = slot(2, i);
+    } else if (idx < 1UL << level_shift(4)) {
+        int i = (expires >> level_shift(3)) & LEVEL_MASK;
+        s = slot(3, i);
+    } else if ((signed long) idx < 0) {
+        /*
+         * Can happen if you add a timer with expires == jiffies,
+         * or you set a timer to go off in the past
+         */
+        s = slot(0, m_base.timer_expire & ROOT_MASK);
+    } else {
+        int i;
+        /* If the timeout is larger than the wheel can hold
+         * then we use the maximum timeout:
+         */
+        const unsigned long max_idx = (unsigned long)((1ULL << (Root_Bits + 4 * Level_Bits)) - 1);
+        if (idx > max_idx) {
+            idx = max_idx;
+            expires = idx + m_base.timer_expire;
+        }
+        i = (expires >> level_shift(4)) & LEVEL_MASK;
+        s = slot(4, i);
+    }
+
+    /*
+     * Timers are FIFO:
+     */
+    timer_wheel_detail::list_add_tail(&timer->entry, slot_head(s));
+    timer->wheel_slot = s;
+    set_slot_bit(s);
+
+    //新定时器可能比缓存的下一个tick更早
+    if (m_base.next_timer_valid) {
+        unsigned long tick = slot_tick(s);
+        if (timer_wheel_detail::time_before(tick, m_base.next_timer)) {
+            m_base.next_timer = tick;
+        }
+    }
+
+    return 0;
+}
+
+template<unsigned long Tick_Us, int Root_Bits, int Level_Bits>
+int Timer_Wheel_Impl<Tick_Us, Root_Bits, Level_Bits>::cascade(int level, int index)
+{
+    /* cascade all the timers from tv up one level */
+    struct list_head tv_list;
+    struct list_head* head = m_base.tvn[level - 1] + index;
+
+    if (timer_wheel_detail::list_empty(head)) {
+        return index;
+    }
+
+    timer_wheel_detail::list_replace_init(head, &tv_list);
+    clear_slot_bit(slot(level, index));
+
+    /*
+     * We are removing _all_ timers from the list, so we
+     * don't have to detach them individually.
+     */
+    struct list_head* pos = tv_list.next;
+    while (pos != &tv_list) {
+        struct list_head* next = pos->next;
+        internal_add_timer(timer_wheel_detail::timer_of(pos));
+        pos = next;
+    }
+
+    return index;
+}
+
+/**
+ * __run_timers - run all expired timers (if any) on this CPU.
+ * @base: the timer vector to be processed.
+ *
+ * This function cascades all vectors and executes all expired timer
+ * vectors.
+ */
+template<unsigned long Tick_Us, int Root_Bits, int Level_Bits>
+int Timer_Wheel_Impl<Tick_Us, Root_Bits, Level_Bits>::expire(const timeval* tv, Timer_Batch* batch)
+{
+    using namespace timer_wheel_detail;
+
+    struct timer_list *timer;
+    unsigned long expire = to_tick(tv);
+
+    while (time_after_eq(expire, m_base.timer_expire)) {
+        struct list_head work_list;
+        struct list_head *head = &work_list;
+        unsigned long next;
+
+        //直接跳到下一个有事可做的tick, 中间的tick上既没有定时器到期也没有需要cascade的槽
+        if (!next_timer(&next) || time_after(next, expire)) {
+            m_base.timer_expire = expire + 1;
+            break;
+        }
+        m_base.timer_expire = next;
+
+        int index = m_base.timer_expire & ROOT_MASK;
+
+        /*
+         * Cascade timers:
+         */
+        #define INDEX(N) ((m_base.timer_expire >> (Root_Bits + (N) * Level_Bits)) & LEVEL_MASK)
+        if (!index &&
+             (!cascade(1, INDEX(0))) &&
+                (!cascade(2, INDEX(1))) &&
+                    !cascade(3, INDEX(2))
+           )
+        {
+            cascade(4, INDEX(3));
+        }
+        #undef INDEX
+
+        list_replace_init(m_base.tv1 + index, &work_list);
+        clear_slot_bit(slot(0, index));
+
+        ++m_base.timer_expire;
+        m_base.next_timer_valid = 0;
+
+        //遍历执行所有的超时定时器
+        while (!list_empty(head)) {
+            timer = timer_of(head->next);
+            bool periodic = timer->interval > 0;
+
+            //间隔为1s的定时器, 10s后才调用expire, 默认回调10次;
+            //TIMER_COALESCE的定时器只回调1次, 参数为少回调的9次, 下次到期时间跳到tv之后
+            unsigned long missed = 0;
+            if (periodic && (timer->flags & timer_list::TIMER_COALESCE) && time_after(expire, timer->expires)) {
+                missed = (expire - timer->expires) / timer->interval;
+            }
+
+            //回调可能取消本定时器, 因此先把回调移出来再执行
+            Timer_Callback fn = std::move(timer->fn);
+            std::shared_ptr<Timer_Callback> shared = timer->shared_fn;
+            unsigned int gen = timer->gen;
+
+            detach_timer(timer, 1);
+            if (periodic) {
+                //周期性定时器
+                timer->expires += (missed + 1) * timer->interval;
+                internal_add_timer(timer);
+            } else {
+                //一次性定时器, 回收。
+                //注意：此处已将定时器删除，外层应避免再次调用cancel_timer取消此定时器，否则会出错
+                free_list_.free(timer);
+            }
+
+            if (batch) {
+                //周期性定时器的回调还要留给下一次, 改为共享
+                if (periodic && !shared) {
+                    shared = std::make_shared<Timer_Callback>(std::move(fn));
+                    timer->shared_fn = shared;
+                }
+                Expired_Timer e = { std::move(fn), missed };
+                if (shared) {
+                    e.fn = [shared](unsigned long n) { (*shared)(n); };
+                }
+                batch->push_back(std::move(e));
+                continue;
+            }
+
+            if (shared) {
+                (*shared)(missed);
+                continue;
+            }
+
+            fn(missed);
+
+            //周期性定时器没有在回调中被取消, 把回调放回去
+            if (periodic && timer->gen == gen) {
+                timer->fn = std::move(fn);
+            }
+        }
+    }
+
+    return 0;
+}
+
+//默认的毫秒时间轮在timer_wheel.cpp中实例化
+extern template class Timer_Wheel_Impl<>;
 //////////////////////////////////////////////////////////////////////////
 
 //////////////////////  下面是对外提供的接口, 原来是分2个文件现在合在一起了 ///////////////////////////////////
 typedef void* Timer_handle;
 
-class Timer_wheel: private Timer_Wheel_Impl
+//模板参数同Timer_Wheel_Impl, 不同精度的时间轮可以同时使用
+template<unsigned long Tick_Us = 1000, int Root_Bits = 8, int Level_Bits = 6>
+class Basic_Timer_wheel: private Timer_Wheel_Impl<Tick_Us, Root_Bits, Level_Bits>
 {
+    typedef Timer_Wheel_Impl<Tick_Us, Root_Bits, Level_Bits> Impl;
+
 public:
+    enum { TICK_US = Tick_Us };
+
+    //起始时间为当前系统时间(gettimeofday)
+    Basic_Timer_wheel() {}
+
+    //起始时间为start, schedule/expire传入的时间要和它是同一个时钟
+    explicit Basic_Timer_wheel(const timeval* start) : Impl(start) {}
+
     //新增一个定时器, 返回NULL为失败, 其它值为成功。欲取消此定时器，调用cancel_timer
     template<typename F, typename ...Args>
     Timer_handle schedule(
                          const timeval* expire_tv,     //超时时间
-                         unsigned long interval,       //0:一次性定时器; >0 :周期性定时器. 单位：毫秒
+                         unsigned long interval,       //0:一次性定时器; >0 :周期性定时器. 单位：tick(Timer_wheel为毫秒)
                          F&& f,
                          Args&& ...args
                          )
     {
         //using return_type = decltype(f(args...));
         auto task = std::bind(f, args...);
-        return (Timer_handle)Timer_Wheel_Impl::add_timer(task, expire_tv, interval);
+        return (Timer_handle)Impl::add_timer(std::move(task), expire_tv, interval);
     }
 
     //取消一个定时器. 0-成功，其它值-失败
     int cancel_timer(Timer_handle timer) {
         if (timer) {
-            return Timer_Wheel_Impl::remove_timer((timer_list*)timer);
+            return Impl::remove_timer((timer_list*)timer);
         }
         return 0;
     }
 
+    //新增一个合并触发的周期性定时器: 落后多个周期时(如expire调用得不及时)只回调一次,
+    //回调为f(args..., missed), missed为合并掉的次数, 按时触发时为0
+    template<typename F, typename ...Args>
+    Timer_handle schedule_coalesced(const timeval* expire_tv, unsigned long interval, F&& f, Args&& ...args)
+    {
+        auto task = std::bind(f, args..., std::placeholders::_1);
+        return (Timer_handle)Impl::add_timer(std::move(task), expire_tv, interval, timer_list::TIMER_COALESCE);
+    }
+
     //循环调用此函数，触发所有过期的定时器, tv值可取当前系统时间
     int expire(const timeval* tv) {
-        return Timer_Wheel_Impl::expire(tv);
+        return Impl::expire(tv);
     }
 
+    //只收集过期的回调, 不执行. 依次调用batch中的每一项即可执行
+    int expire(const timeval* tv, Timer_Batch& batch) {
+        return Impl::expire(tv, &batch);
+    }
+
+    //收集过期的回调, 作为一个任务提交给pool(如Thread_Pool, 需要有bool post(F)), 回调在pool的线程上依次执行,
+    //expire所在的线程不再被回调阻塞. pool拒绝时在当前线程执行. 返回本次到期的回调数
+    //注意: 周期性定时器的回调可能在上一次还没执行完时又被提交, 需要自己处理并发; 已提交的回调不能再取消
+    template<typename Pool>
+    int expire_to(Pool& pool, const timeval* tv)
+    {
+        Timer_Batch batch;
+        Impl::expire(tv, &batch);
+        if (batch.empty()) {
+            return 0;
+        }
+
+        int count = static_cast<int>(batch.size());
+        std::shared_ptr<Timer_Batch> p = std::make_shared<Timer_Batch>(std::move(batch));
+        if (!pool.post([p]() { run_batch(*p); })) {
+            run_batch(*p);
+        }
+        return count;
+    }
+
+    static void run_batch(Timer_Batch& batch)
+    {
+        for (size_t i = 0; i < batch.size(); ++i) {
+            batch[i]();
+        }
+    }
+
+    //距离下一次需要调用expire还有多少个tick(Timer_wheel为毫秒), 没有定时器返回-1. 可作为epoll_wait等的超时时间
+    long next_timeout(const timeval* tv) {
+        return Impl::next_timeout(tv);
+    }
+
+    using Impl::to_tick;
 };
 
+//毫秒精度的时间轮
+typedef Basic_Timer_wheel<> Timer_wheel;
 
 #endif
-